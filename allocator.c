@@ -0,0 +1,137 @@
+#include <string.h>
+#include <stdlib.h>
+#include "allocator.h"
+#include "utils.h"
+
+static void *heap_reallocate(void *context, void *ptr, size_t old_size, size_t new_size)
+{
+    (void)context;
+    (void)old_size;
+    if (new_size == 0)
+    {
+        safe_free(ptr);
+        return NULL;
+    }
+    return safe_realloc(ptr, new_size);
+}
+
+CalcAllocator heap_allocator(void)
+{
+    CalcAllocator allocator = {heap_reallocate, NULL};
+    return allocator;
+}
+
+void *calc_allocate(const CalcAllocator *allocator, size_t size)
+{
+    return allocator->reallocate(allocator->context, NULL, 0, size);
+}
+
+void *calc_reallocate(const CalcAllocator *allocator, void *ptr, size_t old_size, size_t new_size)
+{
+    return allocator->reallocate(allocator->context, ptr, old_size, new_size);
+}
+
+void calc_release(const CalcAllocator *allocator, void *ptr, size_t size)
+{
+    if (ptr != NULL)
+        allocator->reallocate(allocator->context, ptr, size, 0);
+}
+
+void fixed_pool_init(FixedPool *pool, size_t block_size)
+{
+    // Free blocks hold the free list link; keep every block aligned
+    size_t align = _Alignof(max_align_t);
+    if (block_size < sizeof(void *))
+        block_size = sizeof(void *);
+    pool->block_size = (block_size + align - 1) / align * align;
+    pool->slab_blocks = FIXED_POOL_SLAB_BLOCKS;
+    pool->free_list = NULL;
+    pool->slabs = NULL;
+    pool->slab_count = 0;
+    pool->blocks_in_use = 0;
+}
+
+// Carve a new slab into free blocks
+static int add_slab(FixedPool *pool)
+{
+    PoolSlab *slab = safe_malloc(sizeof(PoolSlab) + pool->block_size * pool->slab_blocks);
+    if (slab == NULL)
+        return 0;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->slab_count++;
+    for (size_t i = pool->slab_blocks; i-- > 0;)
+    {
+        void **block = (void **)(slab->blocks + i * pool->block_size);
+        *block = pool->free_list;
+        pool->free_list = block;
+    }
+    return 1;
+}
+
+void *fixed_pool_alloc(FixedPool *pool)
+{
+    if (pool->free_list == NULL && !add_slab(pool))
+        return NULL;
+    void **block = pool->free_list;
+    pool->free_list = *block;
+    pool->blocks_in_use++;
+    return block;
+}
+
+void fixed_pool_release(FixedPool *pool, void *block)
+{
+    if (block == NULL)
+        return;
+    *(void **)block = pool->free_list;
+    pool->free_list = block;
+    pool->blocks_in_use--;
+}
+
+void fixed_pool_free(FixedPool *pool)
+{
+    while (pool->slabs != NULL)
+    {
+        PoolSlab *next = pool->slabs->next;
+        safe_free(pool->slabs);
+        pool->slabs = next;
+    }
+    fixed_pool_init(pool, pool->block_size);
+}
+
+static void *pool_reallocate(void *context, void *ptr, size_t old_size, size_t new_size)
+{
+    FixedPool *pool = context;
+    int old_pooled = ptr != NULL && old_size <= pool->block_size;
+    int new_pooled = new_size > 0 && new_size <= pool->block_size;
+
+    if (new_size == 0)
+    {
+        if (old_pooled)
+            fixed_pool_release(pool, ptr);
+        else
+            safe_free(ptr);
+        return NULL;
+    }
+    if (old_pooled && new_pooled)
+        return ptr; // Still fits its block
+    if (ptr != NULL && !old_pooled && !new_pooled)
+        return safe_realloc(ptr, new_size);
+
+    // Moving between the pool and the heap
+    void *moved = new_pooled ? fixed_pool_alloc(pool) : safe_malloc(new_size);
+    if (moved == NULL || ptr == NULL)
+        return moved;
+    memcpy(moved, ptr, old_size < new_size ? old_size : new_size);
+    if (old_pooled)
+        fixed_pool_release(pool, ptr);
+    else
+        safe_free(ptr);
+    return moved;
+}
+
+CalcAllocator fixed_pool_allocator(FixedPool *pool)
+{
+    CalcAllocator allocator = {pool_reallocate, pool};
+    return allocator;
+}
@@ -0,0 +1,53 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <stddef.h>
+
+// Small allocation interface for containers that can take their memory from
+// somewhere other than the heap. reallocate(context, ptr, old_size, new_size)
+// allocates when ptr is NULL and releases when new_size is 0; callers always
+// pass the size they last asked for as old_size.
+typedef struct
+{
+    void *(*reallocate)(void *context, void *ptr, size_t old_size, size_t new_size);
+    void *context;
+} CalcAllocator;
+
+// safe_malloc and friends
+CalcAllocator heap_allocator(void);
+
+void *calc_allocate(const CalcAllocator *allocator, size_t size);
+void *calc_reallocate(const CalcAllocator *allocator, void *ptr, size_t old_size, size_t new_size);
+void calc_release(const CalcAllocator *allocator, void *ptr, size_t size);
+
+#define FIXED_POOL_SLAB_BLOCKS 1024
+
+// One slab of pool blocks; slabs are only returned by fixed_pool_free
+typedef struct PoolSlab
+{
+    struct PoolSlab *next;
+    _Alignas(max_align_t) unsigned char blocks[];
+} PoolSlab;
+
+// Pool of equal-sized blocks with a free list. As an allocator it serves
+// every request of up to block_size bytes from the pool; growing within a
+// block returns the same pointer, larger requests go to the heap.
+// Not thread-safe.
+typedef struct
+{
+    size_t block_size;
+    size_t slab_blocks;
+    void *free_list;
+    PoolSlab *slabs;
+    size_t slab_count;
+    size_t blocks_in_use;
+} FixedPool;
+
+void fixed_pool_init(FixedPool *pool, size_t block_size);
+void *fixed_pool_alloc(FixedPool *pool);
+void fixed_pool_release(FixedPool *pool, void *block);
+// Release every slab; blocks still in use become invalid
+void fixed_pool_free(FixedPool *pool);
+CalcAllocator fixed_pool_allocator(FixedPool *pool);
+
+#endif // ALLOCATOR_H
@@ -0,0 +1,108 @@
+#include <string.h>
+#include <stdlib.h>
+#include "arena.h"
+#include "utils.h"
+
+void arena_init(StringArena *arena, size_t chunk_size)
+{
+    if (arena == NULL)
+        return;
+    arena->head = NULL;
+    arena->chunk_size = chunk_size > 0 ? chunk_size : ARENA_CHUNK_SIZE;
+    arena->chunk_count = 0;
+}
+
+static ArenaChunk *new_chunk(size_t size)
+{
+    ArenaChunk *chunk = safe_malloc(sizeof(ArenaChunk) + size);
+    if (chunk == NULL)
+        return NULL;
+    chunk->next = NULL;
+    chunk->used = 0;
+    chunk->size = size;
+    return chunk;
+}
+
+// Bump-allocate size bytes (no alignment: the arena only holds strings)
+void *arena_alloc(StringArena *arena, size_t size)
+{
+    if (arena == NULL)
+        return NULL;
+
+    ArenaChunk *head = arena->head;
+    if (head != NULL && head->size - head->used >= size)
+    {
+        void *ptr = head->data + head->used;
+        head->used += size;
+        return ptr;
+    }
+
+    if (size > arena->chunk_size / 4 && head != NULL)
+    {
+        // Large request: give it a dedicated chunk behind the head so the
+        // space left in the current chunk is not wasted
+        ArenaChunk *chunk = new_chunk(size);
+        if (chunk == NULL)
+            return NULL;
+        chunk->used = size;
+        chunk->next = head->next;
+        head->next = chunk;
+        arena->chunk_count++;
+        return chunk->data;
+    }
+
+    ArenaChunk *chunk = new_chunk(size > arena->chunk_size ? size : arena->chunk_size);
+    if (chunk == NULL)
+        return NULL;
+    chunk->used = size;
+    chunk->next = head;
+    arena->head = chunk;
+    arena->chunk_count++;
+    return chunk->data;
+}
+
+// Copy length bytes into the arena and NUL-terminate them
+char *arena_strndup(StringArena *arena, const char *source, size_t length)
+{
+    char *copy = arena_alloc(arena, length + 1);
+    if (copy == NULL)
+        return NULL;
+    memcpy(copy, source, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+// Release everything except the current chunk, which is kept for reuse
+void arena_reset(StringArena *arena)
+{
+    if (arena == NULL || arena->head == NULL)
+        return;
+
+    ArenaChunk *keep = arena->head;
+    ArenaChunk *chunk = keep->next;
+    while (chunk != NULL)
+    {
+        ArenaChunk *next = chunk->next;
+        safe_free(chunk);
+        chunk = next;
+    }
+    keep->next = NULL;
+    keep->used = 0;
+    arena->chunk_count = 1;
+}
+
+void arena_free(StringArena *arena)
+{
+    if (arena == NULL)
+        return;
+
+    ArenaChunk *chunk = arena->head;
+    while (chunk != NULL)
+    {
+        ArenaChunk *next = chunk->next;
+        safe_free(chunk);
+        chunk = next;
+    }
+    arena->head = NULL;
+    arena->chunk_count = 0;
+}
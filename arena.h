@@ -0,0 +1,32 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+// One block of arena memory; chunks never move once allocated
+typedef struct ArenaChunk
+{
+    struct ArenaChunk *next; // Older chunk
+    size_t used;             // Bytes handed out from data
+    size_t size;             // Bytes available in data
+    char data[];
+} ArenaChunk;
+
+// Chunked bump-pointer allocator. Individual allocations are never freed;
+// everything is released at once, in O(number of chunks).
+typedef struct
+{
+    ArenaChunk *head;   // Chunk currently being filled
+    size_t chunk_size;  // Size of regular chunks
+    size_t chunk_count; // Chunks currently allocated
+} StringArena;
+
+void arena_init(StringArena *arena, size_t chunk_size);
+void *arena_alloc(StringArena *arena, size_t size);
+char *arena_strndup(StringArena *arena, const char *source, size_t length);
+void arena_reset(StringArena *arena);
+void arena_free(StringArena *arena);
+
+#endif // ARENA_H
@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "calculator.h"
+#include "utils.h"
+#include "thread_pool.h"
+
+// Evaluate one NUL-terminated line; trims a trailing CR in place
+static CalcResult evaluate_line(char *line, size_t *length, ExpressionCache *cache,
+                                double *result, char *error_msg)
+{
+    // Tolerate CRLF input
+    if (*length > 0 && line[*length - 1] == '\r')
+        line[--*length] = '\0';
+
+    *result = 0.0;
+    if (*length == 0)
+    {
+        strcpy(error_msg, "Empty input");
+        return CALC_INVALID_INPUT;
+    }
+    CalcResult calc_result = cached_parse_expression(cache, line, result, error_msg);
+    if (calc_result != CALC_SUCCESS && (calc_result != CALC_INVALID_INPUT || error_msg[0] == '\0'))
+        strcpy(error_msg, calc_error_message(calc_result));
+    return calc_result;
+}
+
+// Output line for one evaluation; text needs BATCH_LINE_OUTPUT_SIZE bytes
+static size_t format_line_output(CalcResult calc_result, double result, const char *error_msg,
+                                 char *text)
+{
+    size_t text_length;
+    if (calc_result == CALC_SUCCESS)
+        text_length = (size_t)format_double(result, text, DOUBLE_STRING_SIZE);
+    else
+        text_length = (size_t)snprintf(text, BATCH_LINE_OUTPUT_SIZE - 1, "ERROR: %s", error_msg);
+    text[text_length++] = '\n';
+    return text_length;
+}
+
+// State of one run_batch call
+typedef struct
+{
+    const BatchOptions *options;
+    OutputBuffer *output;
+    long failures;
+
+    // Parallel evaluation: lines of the current read are collected, evaluated
+    // by the pool in tasks of BATCH_TASK_LINES, then written in input order
+    ThreadPool *pool;
+    ExpressionCache *caches; // One per worker; the caches are not thread-safe
+    char **lines;
+    size_t *lengths;
+    double *results;
+    signed char *statuses;
+    size_t line_count;
+    size_t line_capacity;
+    ByteBuffer *task_output; // Output text per task
+    long *task_failures;
+    unsigned char *task_lost; // Set when a task could not store all of its output
+    size_t task_capacity;
+} BatchState;
+
+size_t batch_evaluate_line(char *line, size_t length, ExpressionCache *cache,
+                           CalculationHistory *hist, char *text, int *failed)
+{
+    double result;
+    char error_msg[CALC_ERROR_MSG_SIZE] = "";
+    CalcResult calc_result = evaluate_line(line, &length, cache, &result, error_msg);
+    if (hist != NULL && length > 0)
+        add_calculation(hist, line, result, calc_result);
+    *failed = calc_result != CALC_SUCCESS;
+    return format_line_output(calc_result, result, error_msg, text);
+}
+
+// Evaluate one line on the calling thread and write it out immediately
+static void process_line(BatchState *state, char *line, size_t length)
+{
+    char text[BATCH_LINE_OUTPUT_SIZE];
+    int failed;
+    size_t text_length = batch_evaluate_line(line, length, state->options->cache,
+                                             state->options->history, text, &failed);
+    output_buffer_write(state->output, text, text_length);
+    state->failures += failed;
+}
+
+static void evaluate_task(void *context, size_t task, int worker)
+{
+    BatchState *state = context;
+    ExpressionCache *cache = state->caches != NULL ? &state->caches[worker] : NULL;
+    ByteBuffer *output = &state->task_output[task];
+    size_t begin = task * BATCH_TASK_LINES;
+    size_t end = begin + BATCH_TASK_LINES < state->line_count ? begin + BATCH_TASK_LINES : state->line_count;
+
+    output->length = 0;
+    state->task_failures[task] = 0;
+    state->task_lost[task] = 0;
+    for (size_t i = begin; i < end; i++)
+    {
+        char error_msg[CALC_ERROR_MSG_SIZE] = "";
+        CalcResult calc_result = evaluate_line(state->lines[i], &state->lengths[i], cache,
+                                               &state->results[i], error_msg);
+        state->statuses[i] = (signed char)calc_result;
+        if (calc_result != CALC_SUCCESS)
+            state->task_failures[task]++;
+
+        if (!byte_buffer_reserve(output, BATCH_LINE_OUTPUT_SIZE))
+        {
+            state->task_lost[task] = 1; // Out of memory: this line's output is lost
+            continue;
+        }
+        output->length += format_line_output(calc_result, state->results[i], error_msg,
+                                             (char *)output->data + output->length);
+    }
+}
+
+// Evaluate the collected lines in parallel, then write them in input order.
+// Returns 0 if some output line could not be stored
+static int flush_lines(BatchState *state)
+{
+    if (state->line_count == 0)
+        return 1;
+
+    size_t tasks = (state->line_count + BATCH_TASK_LINES - 1) / BATCH_TASK_LINES;
+    thread_pool_run(state->pool, tasks, evaluate_task, state);
+
+    int complete = 1;
+    for (size_t t = 0; t < tasks; t++)
+    {
+        if (state->task_lost[t])
+            complete = 0;
+        output_buffer_write(state->output, (const char *)state->task_output[t].data,
+                            state->task_output[t].length);
+        state->failures += state->task_failures[t];
+    }
+    // History is shared; record in input order on this thread
+    if (state->options->history != NULL)
+    {
+        for (size_t i = 0; i < state->line_count; i++)
+        {
+            if (state->lengths[i] > 0)
+                add_calculation(state->options->history, state->lines[i], state->results[i],
+                                (CalcResult)state->statuses[i]);
+        }
+    }
+    state->line_count = 0;
+    return complete;
+}
+
+static int grow_line_arrays(BatchState *state)
+{
+    size_t capacity = state->line_capacity > 0 ? state->line_capacity * 2 : BATCH_TASK_LINES * 16;
+    char **lines = safe_realloc(state->lines, capacity * sizeof(char *));
+    if (lines != NULL)
+        state->lines = lines;
+    size_t *lengths = safe_realloc(state->lengths, capacity * sizeof(size_t));
+    if (lengths != NULL)
+        state->lengths = lengths;
+    double *results = safe_realloc(state->results, capacity * sizeof(double));
+    if (results != NULL)
+        state->results = results;
+    signed char *statuses = safe_realloc(state->statuses, capacity);
+    if (statuses != NULL)
+        state->statuses = statuses;
+    if (lines == NULL || lengths == NULL || results == NULL || statuses == NULL)
+        return 0;
+
+    size_t task_capacity = capacity / BATCH_TASK_LINES;
+    ByteBuffer *task_output = safe_realloc(state->task_output, task_capacity * sizeof(ByteBuffer));
+    if (task_output != NULL)
+    {
+        for (size_t t = state->task_capacity; t < task_capacity; t++)
+            byte_buffer_init(&task_output[t]);
+        state->task_output = task_output;
+        state->task_capacity = task_capacity;
+    }
+    long *task_failures = safe_realloc(state->task_failures, task_capacity * sizeof(long));
+    if (task_failures != NULL)
+        state->task_failures = task_failures;
+    unsigned char *task_lost = safe_realloc(state->task_lost, task_capacity);
+    if (task_lost != NULL)
+        state->task_lost = task_lost;
+    if (task_output == NULL || task_failures == NULL || task_lost == NULL)
+        return 0;
+
+    state->line_capacity = capacity;
+    return 1;
+}
+
+// Hand one complete line to the evaluator
+static int submit_line(BatchState *state, char *line, size_t length)
+{
+    if (state->pool == NULL)
+    {
+        process_line(state, line, length);
+        return 1;
+    }
+    if (state->line_count == state->line_capacity && !grow_line_arrays(state))
+        return 0;
+    state->lines[state->line_count] = line;
+    state->lengths[state->line_count] = length;
+    state->line_count++;
+    return 1;
+}
+
+static int start_workers(BatchState *state)
+{
+    state->pool = thread_pool_create(state->options->threads);
+    if (state->pool == NULL)
+        return 0;
+
+    ExpressionCache *shared = state->options->cache;
+    if (shared != NULL && shared->capacity > 0)
+    {
+        int workers = thread_pool_size(state->pool);
+        state->caches = safe_calloc(workers, sizeof(ExpressionCache));
+        for (int i = 0; state->caches != NULL && i < workers; i++)
+            expression_cache_init(&state->caches[i], shared->capacity); // A failed one just stays disabled
+    }
+    return 1;
+}
+
+static void stop_workers(BatchState *state)
+{
+    if (state->caches != NULL)
+    {
+        // Report the workers' cache activity through the caller's cache
+        ExpressionCache *shared = state->options->cache;
+        for (int i = 0; i < thread_pool_size(state->pool); i++)
+        {
+            shared->hits += state->caches[i].hits;
+            shared->misses += state->caches[i].misses;
+            shared->evictions += state->caches[i].evictions;
+            expression_cache_free(&state->caches[i]);
+        }
+        safe_free(state->caches);
+    }
+    thread_pool_destroy(state->pool);
+    for (size_t t = 0; t < state->task_capacity; t++)
+        byte_buffer_free(&state->task_output[t]);
+    safe_free(state->task_output);
+    safe_free(state->task_failures);
+    safe_free(state->task_lost);
+    safe_free(state->lines);
+    safe_free(state->lengths);
+    safe_free(state->results);
+    safe_free(state->statuses);
+}
+
+long run_batch(FILE *in, FILE *out, const BatchOptions *options)
+{
+    if (in == NULL || out == NULL || options == NULL)
+        return -1;
+
+    OutputBuffer output;
+    if (!output_buffer_init(&output, out, BATCH_BUFFER_SIZE))
+        return -1;
+
+    size_t capacity = BATCH_BUFFER_SIZE;
+    char *buffer = safe_malloc(capacity + 1); // +1 for a terminator after a final unterminated line
+    if (buffer == NULL)
+    {
+        output_buffer_free(&output);
+        return -1;
+    }
+
+    BatchState state;
+    memset(&state, 0, sizeof(state));
+    state.options = options;
+    state.output = &output;
+    if (options->threads > 1 && !start_workers(&state))
+        state.pool = NULL; // Fall back to evaluating here
+
+    int read_error = 0;
+    size_t filled = 0;
+    int at_eof = 0;
+    while (!at_eof)
+    {
+        size_t got = fread(buffer + filled, 1, capacity - filled, in);
+        if (got < capacity - filled)
+        {
+            if (ferror(in))
+            {
+                read_error = 1;
+                break;
+            }
+            at_eof = 1;
+        }
+        filled += got;
+
+        // Evaluate every complete line in place
+        char *line = buffer;
+        char *end = buffer + filled;
+        char *newline;
+        while (!read_error && (newline = memchr(line, '\n', end - line)) != NULL)
+        {
+            *newline = '\0';
+            read_error = !submit_line(&state, line, newline - line);
+            line = newline + 1;
+        }
+
+        size_t remaining = end - line;
+        if (at_eof && remaining > 0 && !read_error)
+        {
+            line[remaining] = '\0';
+            read_error = !submit_line(&state, line, remaining);
+        }
+        // Lines point into the buffer, so finish them before it is reused
+        if (!flush_lines(&state))
+            read_error = 1;
+        if (at_eof || read_error)
+            break;
+
+        if (line == buffer && remaining == capacity)
+        {
+            // A single line fills the whole buffer; make room for the rest of it
+            char *grown = safe_realloc(buffer, capacity * 2 + 1);
+            if (grown == NULL)
+            {
+                read_error = 1;
+                break;
+            }
+            buffer = grown;
+            capacity *= 2;
+        }
+        else
+        {
+            // Carry the partial line over to the next read
+            memmove(buffer, line, remaining);
+        }
+        filled = remaining;
+    }
+
+    if (state.pool != NULL)
+        stop_workers(&state);
+    output_buffer_flush(&output);
+    output_buffer_free(&output);
+    safe_free(buffer);
+    return read_error ? -1 : state.failures;
+}
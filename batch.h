@@ -0,0 +1,32 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include "history.h"
+#include "cache.h"
+
+// Read size and output buffer size for batch mode
+#define BATCH_BUFFER_SIZE (1 << 20)
+#define BATCH_TASK_LINES 1024 // Lines per parallel evaluation task
+#define BATCH_LINE_OUTPUT_SIZE (CALC_ERROR_MSG_SIZE + 8) // "ERROR: " + message + newline
+
+typedef struct
+{
+    CalculationHistory *history; // Record results here, or NULL to skip history
+    ExpressionCache *cache;      // Reuse results of repeated lines, or NULL
+    int threads;                 // Evaluate on this many threads; 1 or less: calling thread only
+} BatchOptions;
+
+// Evaluate newline-separated expressions from in and write one result line
+// per input line to out. Returns the number of lines that failed to
+// evaluate, or -1 on a read or allocation error. Output and history keep
+// the input order whatever the thread count.
+long run_batch(FILE *in, FILE *out, const BatchOptions *options);
+
+// Evaluate one NUL-terminated line the way batch mode does and record it in
+// hist (if not NULL). Writes the output line, newline included, to text,
+// which needs BATCH_LINE_OUTPUT_SIZE bytes; returns its length.
+size_t batch_evaluate_line(char *line, size_t length, ExpressionCache *cache,
+                           CalculationHistory *hist, char *text, int *failed);
+
+#endif // BATCH_H
@@ -0,0 +1,486 @@
+// Microbenchmarks for the hot paths: expression parsing, number parsing and
+// formatting, history appends and history file loading.
+//
+//   calc_bench [--ops N] [--entries N] [--rounds N] [--seed S]
+//              [--only NAME] [--json FILE]
+//
+// Inputs are generated from a seeded PRNG, so runs with the same options
+// measure the same work. Each benchmark is timed in samples of several
+// operations; percentiles are over the per-operation time of each sample.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "calculator.h"
+#include "history.h"
+#include "utils.h"
+
+#define DEFAULT_BENCH_OPS 200000
+#define DEFAULT_BENCH_ENTRIES 100000
+#define DEFAULT_BENCH_ROUNDS 20
+#define BENCH_SAMPLE_OPS 256 // Operations per timed sample for cheap operations
+#define BENCH_EXPRESSION_SIZE 128
+#define BENCH_HISTORY_FILE "bench_history.dat"
+
+// Allocation counters. Built with -Wl,--wrap=malloc,... (see `make bench`),
+// every malloc/calloc/realloc in the process goes through these.
+static size_t allocation_count = 0;
+static size_t allocation_bytes = 0;
+
+#ifdef BENCH_COUNT_ALLOCATIONS
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    allocation_count++;
+    allocation_bytes += size;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    allocation_count++;
+    allocation_bytes += count * size;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    allocation_count++;
+    allocation_bytes += size;
+    return __real_realloc(ptr, size);
+}
+#endif
+
+typedef struct
+{
+    long ops;      // Operations for the cheap benchmarks
+    long entries;  // Entries in the generated history file
+    long rounds;   // Loads of the history file
+    unsigned long seed;
+    const char *only; // Run just this benchmark, or NULL
+    const char *json; // Write results here as JSON, or NULL
+} BenchOptions;
+
+// Generated inputs shared by the benchmarks
+typedef struct
+{
+    char (*expressions)[BENCH_EXPRESSION_SIZE];
+    char (*numbers)[DOUBLE_STRING_SIZE];
+    double *values;
+    size_t count;
+    CalculationHistory history; // Target of add_calculation
+    long entries;
+} BenchData;
+
+typedef struct
+{
+    const char *name;
+    size_t ops;          // Operations timed
+    double total_ns;
+    double p50_ns, p90_ns, p99_ns, max_ns;
+    double allocs_per_op;
+    double bytes_per_op;
+} BenchResult;
+
+// One benchmark: run(data, i) is timed for operations i in [0, ops).
+// prepare/finish run outside the timed region around every sample, done
+// once after the last sample.
+typedef struct
+{
+    const char *name;
+    size_t (*ops)(const BenchOptions *options);
+    size_t sample_ops;
+    void (*prepare)(BenchData *data);
+    void (*run)(BenchData *data, size_t i);
+    void (*finish)(BenchData *data);
+    void (*done)(BenchData *data);
+} Benchmark;
+
+static volatile double sink; // Keeps results alive so the work is not optimised away
+static unsigned long long rng_state;
+
+static unsigned long long next_random(void)
+{
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Append a random number literal: integers, decimals and small fractions
+static size_t generate_number(char *out, size_t size)
+{
+    switch (next_random() % 3)
+    {
+    case 0:
+        return snprintf(out, size, "%llu", next_random() % 100000);
+    case 1:
+        return snprintf(out, size, "%llu.%llu", next_random() % 1000, next_random() % 1000);
+    default:
+        return snprintf(out, size, "0.%03llu", next_random() % 1000);
+    }
+}
+
+// Random expression with 2-8 operands, some parentheses and unary minus
+static void generate_expression(char *out, size_t size)
+{
+    static const char operators[] = "+-*/+-*^";
+    int operands = 2 + (int)(next_random() % 7);
+    int open = 0;
+    size_t length = 0;
+    for (int i = 0; i < operands && length + 32 < size; i++)
+    {
+        if (i > 0)
+            length += snprintf(out + length, size - length, " %c ", operators[next_random() % 8]);
+        if (next_random() % 5 == 0)
+            out[length++] = '-';
+        if (i + 1 < operands && next_random() % 4 == 0)
+        {
+            out[length++] = '(';
+            open++;
+        }
+        length += generate_number(out + length, size - length);
+        if (open > 0 && next_random() % 3 == 0)
+        {
+            out[length++] = ')';
+            open--;
+        }
+    }
+    while (open-- > 0)
+        out[length++] = ')';
+    out[length] = '\0';
+}
+
+static int generate_data(BenchData *data, const BenchOptions *options)
+{
+    rng_state = options->seed | 1;
+    data->count = (size_t)options->ops;
+    data->entries = options->entries;
+    data->expressions = malloc(data->count * sizeof(*data->expressions));
+    data->numbers = malloc(data->count * sizeof(*data->numbers));
+    data->values = malloc(data->count * sizeof(double));
+    if (data->expressions == NULL || data->numbers == NULL || data->values == NULL)
+        return 0;
+
+    for (size_t i = 0; i < data->count; i++)
+    {
+        generate_expression(data->expressions[i], BENCH_EXPRESSION_SIZE);
+        // Mix of short literals and full-precision values
+        if (i % 2 == 0)
+            generate_number(data->numbers[i], DOUBLE_STRING_SIZE);
+        else
+            format_double((double)next_random() / (double)(1ULL << 40), data->numbers[i],
+                          DOUBLE_STRING_SIZE);
+        data->values[i] = (double)(next_random() % 2000000) / 64.0 - 10000.0;
+    }
+
+    // History file for the load benchmark, written once
+    CalculationHistory hist;
+    init_history(&hist);
+    hist.verbose = 0;
+    time_t start = time(NULL) - options->entries;
+    for (long i = 0; i < options->entries; i++)
+    {
+        const char *expr = data->expressions[i % data->count];
+        double result;
+        CalcResult status = parse_expression(expr, &result, NULL);
+        add_calculation(&hist, expr, result, status);
+        hist.calculations[hist.count - 1].timestamp = start + i;
+    }
+    int saved = save_history_to_file(&hist, BENCH_HISTORY_FILE) == HISTORY_SUCCESS;
+    cleanup_history(&hist);
+    return saved;
+}
+
+static void free_data(BenchData *data)
+{
+    free(data->expressions);
+    free(data->numbers);
+    free(data->values);
+    remove(BENCH_HISTORY_FILE);
+}
+
+static size_t cheap_ops(const BenchOptions *options)
+{
+    return (size_t)options->ops;
+}
+
+static size_t load_ops(const BenchOptions *options)
+{
+    return (size_t)options->rounds;
+}
+
+static void run_parse_expression(BenchData *data, size_t i)
+{
+    double result;
+    parse_expression(data->expressions[i], &result, NULL);
+    sink = result;
+}
+
+static void run_string_to_double(BenchData *data, size_t i)
+{
+    double result;
+    string_to_double(data->numbers[i], &result);
+    sink = result;
+}
+
+static void run_format_double(BenchData *data, size_t i)
+{
+    char text[DOUBLE_STRING_SIZE];
+    sink = format_double(data->values[i], text, sizeof(text));
+}
+
+static void prepare_history(BenchData *data)
+{
+    if (data->history.calculations == NULL)
+    {
+        init_history(&data->history);
+        data->history.verbose = 0;
+    }
+}
+
+// The history grows across samples, as it does in a long session
+static void run_add_calculation(BenchData *data, size_t i)
+{
+    add_calculation(&data->history, data->expressions[i], data->values[i], CALC_SUCCESS);
+}
+
+static void release_history(BenchData *data)
+{
+    cleanup_history(&data->history);
+    memset(&data->history, 0, sizeof(data->history));
+}
+
+static void prepare_load(BenchData *data)
+{
+    init_history(&data->history);
+    data->history.verbose = 0;
+}
+
+static void run_load_history(BenchData *data, size_t i)
+{
+    (void)i;
+    load_history_from_file(&data->history, BENCH_HISTORY_FILE);
+}
+
+static void finish_load(BenchData *data)
+{
+    if (data->history.count != data->entries)
+    {
+        fprintf(stderr, "Error : Loaded %d of %ld history entries\n", data->history.count, data->entries);
+        exit(1);
+    }
+    release_history(data);
+}
+
+static const Benchmark benchmarks[] = {
+    {"parse_expression", cheap_ops, BENCH_SAMPLE_OPS, NULL, run_parse_expression, NULL, NULL},
+    {"string_to_double", cheap_ops, BENCH_SAMPLE_OPS, NULL, run_string_to_double, NULL, NULL},
+    {"format_double", cheap_ops, BENCH_SAMPLE_OPS, NULL, run_format_double, NULL, NULL},
+    {"add_calculation", cheap_ops, BENCH_SAMPLE_OPS, prepare_history, run_add_calculation, NULL,
+     release_history},
+    {"load_history_from_file", load_ops, 1, prepare_load, run_load_history, finish_load, NULL},
+};
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, size_t count, double fraction)
+{
+    size_t index = (size_t)(fraction * (double)(count - 1) + 0.5);
+    return sorted[index];
+}
+
+static int run_benchmark(const Benchmark *bench, BenchData *data, const BenchOptions *options,
+                         BenchResult *result)
+{
+    size_t ops = bench->ops(options);
+    size_t samples = (ops + bench->sample_ops - 1) / bench->sample_ops;
+    double *sample_ns = malloc((samples > 0 ? samples : 1) * sizeof(double));
+    if (sample_ns == NULL)
+        return 0;
+
+    memset(result, 0, sizeof(*result));
+    result->name = bench->name;
+    result->ops = ops;
+    size_t allocations = 0, bytes = 0;
+    for (size_t s = 0; s < samples; s++)
+    {
+        size_t begin = s * bench->sample_ops;
+        size_t end = begin + bench->sample_ops < ops ? begin + bench->sample_ops : ops;
+        if (bench->prepare != NULL)
+            bench->prepare(data);
+
+        size_t count_before = allocation_count, bytes_before = allocation_bytes;
+        double start = now_ns();
+        for (size_t i = begin; i < end; i++)
+            bench->run(data, i);
+        double elapsed = now_ns() - start;
+        allocations += allocation_count - count_before;
+        bytes += allocation_bytes - bytes_before;
+
+        if (bench->finish != NULL)
+            bench->finish(data);
+        result->total_ns += elapsed;
+        sample_ns[s] = elapsed / (double)(end - begin);
+    }
+    if (bench->done != NULL)
+        bench->done(data);
+
+    if (samples > 0)
+    {
+        qsort(sample_ns, samples, sizeof(double), compare_doubles);
+        result->p50_ns = percentile(sample_ns, samples, 0.50);
+        result->p90_ns = percentile(sample_ns, samples, 0.90);
+        result->p99_ns = percentile(sample_ns, samples, 0.99);
+        result->max_ns = sample_ns[samples - 1];
+    }
+    if (ops > 0)
+    {
+        result->allocs_per_op = (double)allocations / (double)ops;
+        result->bytes_per_op = (double)bytes / (double)ops;
+    }
+    free(sample_ns);
+    return 1;
+}
+
+static double ns_per_op(const BenchResult *result)
+{
+    return result->ops > 0 ? result->total_ns / (double)result->ops : 0.0;
+}
+
+static void print_results(const BenchResult *results, size_t count)
+{
+    printf("%-24s %10s %12s %14s %10s %10s %10s %10s\n", "benchmark", "ops", "ns/op", "ops/s",
+           "p50 ns", "p99 ns", "allocs/op", "bytes/op");
+    for (size_t i = 0; i < count; i++)
+    {
+        const BenchResult *r = &results[i];
+        double per_op = ns_per_op(r);
+        printf("%-24s %10zu %12.1f %14.0f %10.1f %10.1f %10.2f %10.1f\n", r->name, r->ops, per_op,
+               per_op > 0 ? 1e9 / per_op : 0.0, r->p50_ns, r->p99_ns, r->allocs_per_op, r->bytes_per_op);
+    }
+#ifndef BENCH_COUNT_ALLOCATIONS
+    printf("(allocation counts need the `make bench` build)\n");
+#endif
+}
+
+// One JSON document per run, stable field names for regression tracking
+static int write_json(const char *path, const BenchOptions *options, const BenchResult *results,
+                      size_t count)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        return 0;
+    fprintf(file, "{\n  \"config\": {\"ops\": %ld, \"entries\": %ld, \"rounds\": %ld, \"seed\": %lu, "
+                  "\"sample_ops\": %d, \"allocations_counted\": %s},\n  \"results\": [\n",
+            options->ops, options->entries, options->rounds, options->seed, BENCH_SAMPLE_OPS,
+#ifdef BENCH_COUNT_ALLOCATIONS
+            "true"
+#else
+            "false"
+#endif
+    );
+    for (size_t i = 0; i < count; i++)
+    {
+        const BenchResult *r = &results[i];
+        double per_op = ns_per_op(r);
+        fprintf(file,
+                "    {\"name\": \"%s\", \"ops\": %zu, \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f, "
+                "\"p50_ns\": %.2f, \"p90_ns\": %.2f, \"p99_ns\": %.2f, \"max_ns\": %.2f, "
+                "\"allocs_per_op\": %.4f, \"bytes_per_op\": %.2f}%s\n",
+                r->name, r->ops, per_op, per_op > 0 ? 1e9 / per_op : 0.0, r->p50_ns, r->p90_ns,
+                r->p99_ns, r->max_ns, r->allocs_per_op, r->bytes_per_op, i + 1 < count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    return fclose(file) == 0;
+}
+
+static int parse_options(int argc, char **argv, BenchOptions *options)
+{
+    options->ops = DEFAULT_BENCH_OPS;
+    options->entries = DEFAULT_BENCH_ENTRIES;
+    options->rounds = DEFAULT_BENCH_ROUNDS;
+    options->seed = 42;
+    options->only = NULL;
+    options->json = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+            return 0;
+        const char *value = argv[++i];
+        if (strcmp(argv[i - 1], "--ops") == 0)
+            options->ops = atol(value);
+        else if (strcmp(argv[i - 1], "--entries") == 0)
+            options->entries = atol(value);
+        else if (strcmp(argv[i - 1], "--rounds") == 0)
+            options->rounds = atol(value);
+        else if (strcmp(argv[i - 1], "--seed") == 0)
+            options->seed = strtoul(value, NULL, 10);
+        else if (strcmp(argv[i - 1], "--only") == 0)
+            options->only = value;
+        else if (strcmp(argv[i - 1], "--json") == 0)
+            options->json = value;
+        else
+            return 0;
+    }
+    return options->ops > 0 && options->entries >= 0 && options->rounds > 0;
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions options;
+    if (!parse_options(argc, argv, &options))
+    {
+        fprintf(stderr, "Usage: %s [--ops N] [--entries N] [--rounds N] [--seed S] [--only NAME] [--json FILE]\n",
+                argv[0]);
+        return 1;
+    }
+
+    BenchData data = {0};
+    if (!generate_data(&data, &options))
+    {
+        fprintf(stderr, "Error : Cannot generate benchmark data\n");
+        free_data(&data);
+        return 1;
+    }
+
+    size_t benchmark_count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    BenchResult results[sizeof(benchmarks) / sizeof(benchmarks[0])];
+    size_t result_count = 0;
+    for (size_t i = 0; i < benchmark_count; i++)
+    {
+        if (options.only != NULL && strcmp(options.only, benchmarks[i].name) != 0)
+            continue;
+        if (run_benchmark(&benchmarks[i], &data, &options, &results[result_count]))
+            result_count++;
+    }
+    free_data(&data);
+    if (result_count == 0)
+    {
+        fprintf(stderr, "Error : No benchmark named %s\n", options.only != NULL ? options.only : "");
+        return 1;
+    }
+
+    print_results(results, result_count);
+    if (options.json != NULL && !write_json(options.json, &options, results, result_count))
+    {
+        fprintf(stderr, "Error : Cannot write %s\n", options.json);
+        return 1;
+    }
+    return 0;
+}
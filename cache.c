@@ -0,0 +1,217 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "cache.h"
+#include "utils.h"
+
+// FNV-1a over the normalized key
+static unsigned int hash_key(const char *key)
+{
+    unsigned int hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)key; *p != '\0'; p++)
+    {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Characters that form numbers and names; whitespace between two of them
+// is significant ("1 2" must not become "12")
+static int is_token_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '.' || c == '_';
+}
+
+int expression_cache_init(ExpressionCache *cache, size_t capacity)
+{
+    if (cache == NULL)
+        return 0;
+    memset(cache, 0, sizeof(*cache));
+    if (capacity == 0)
+        return 1;
+
+    // Keep the index at most half full so probe chains stay short
+    size_t slots = 1;
+    while (slots < capacity * 2)
+        slots <<= 1;
+
+    cache->entries = safe_malloc(capacity * sizeof(CacheEntry));
+    cache->index = safe_calloc(slots, sizeof(int));
+    if (cache->entries == NULL || cache->index == NULL)
+    {
+        expression_cache_free(cache);
+        return 0;
+    }
+    cache->capacity = capacity;
+    cache->index_mask = slots - 1;
+    return 1;
+}
+
+void expression_cache_clear(ExpressionCache *cache)
+{
+    if (cache == NULL || cache->index == NULL)
+        return;
+    memset(cache->index, 0, (cache->index_mask + 1) * sizeof(int));
+    cache->count = 0;
+    cache->hand = 0;
+}
+
+void expression_cache_free(ExpressionCache *cache)
+{
+    if (cache == NULL)
+        return;
+    safe_free(cache->entries);
+    safe_free(cache->index);
+    cache->entries = NULL;
+    cache->index = NULL;
+    cache->capacity = 0;
+    cache->count = 0;
+}
+
+int expression_cache_key(const char *expr, char *key)
+{
+    if (expr == NULL || key == NULL)
+        return 0;
+
+    char previous = '\0'; // Last non-space character
+    int after_space = 0;
+    size_t length = 0;
+    for (const char *p = expr; *p != '\0'; p++)
+    {
+        if (*p == ' ' || *p == '\t')
+        {
+            after_space = 1;
+            continue;
+        }
+        if (after_space && is_token_char(previous) && is_token_char(*p))
+            return 0;
+        if (length + 1 >= CACHE_KEY_SIZE)
+            return 0;
+        key[length++] = *p;
+        previous = *p;
+        after_space = 0;
+    }
+    key[length] = '\0';
+    return length > 0;
+}
+
+// Index slot holding key, or the empty slot where it would go
+static size_t find_slot(const ExpressionCache *cache, const char *key, unsigned int hash)
+{
+    size_t slot = hash & cache->index_mask;
+    while (cache->index[slot] != 0)
+    {
+        const CacheEntry *entry = &cache->entries[cache->index[slot] - 1];
+        if (entry->hash == hash && strcmp(entry->key, key) == 0)
+            break;
+        slot = (slot + 1) & cache->index_mask;
+    }
+    return slot;
+}
+
+// Remove an index slot, shifting later members of its probe chain back so
+// lookups never stop early at the hole
+static void remove_slot(ExpressionCache *cache, size_t slot)
+{
+    size_t hole = slot;
+    size_t next = (slot + 1) & cache->index_mask;
+    while (cache->index[next] != 0)
+    {
+        size_t home = cache->entries[cache->index[next] - 1].hash & cache->index_mask;
+        // Move the entry into the hole unless its home lies in (hole, next]
+        if (((next - home) & cache->index_mask) >= ((next - hole) & cache->index_mask))
+        {
+            cache->index[hole] = cache->index[next];
+            hole = next;
+        }
+        next = (next + 1) & cache->index_mask;
+    }
+    cache->index[hole] = 0;
+}
+
+int expression_cache_lookup(ExpressionCache *cache, const char *key,
+                            double *result, CalcResult *status)
+{
+    if (cache == NULL || cache->capacity == 0)
+        return 0;
+
+    size_t slot = find_slot(cache, key, hash_key(key));
+    if (cache->index[slot] == 0)
+    {
+        cache->misses++;
+        return 0;
+    }
+    CacheEntry *entry = &cache->entries[cache->index[slot] - 1];
+    entry->referenced = 1;
+    *result = entry->result;
+    *status = (CalcResult)entry->status;
+    cache->hits++;
+    return 1;
+}
+
+void expression_cache_insert(ExpressionCache *cache, const char *key,
+                             double result, CalcResult status)
+{
+    if (cache == NULL || cache->capacity == 0)
+        return;
+
+    unsigned int hash = hash_key(key);
+    size_t slot = find_slot(cache, key, hash);
+    if (cache->index[slot] != 0)
+        return; // Already cached
+
+    size_t position;
+    if (cache->count < cache->capacity)
+    {
+        position = cache->count++;
+    }
+    else
+    {
+        // CLOCK: give referenced entries a second chance, evict the first
+        // one that has not been used since the hand last passed it
+        while (cache->entries[cache->hand].referenced)
+        {
+            cache->entries[cache->hand].referenced = 0;
+            cache->hand = (cache->hand + 1) % cache->capacity;
+        }
+        position = cache->hand;
+        cache->hand = (cache->hand + 1) % cache->capacity;
+
+        CacheEntry *victim = &cache->entries[position];
+        remove_slot(cache, find_slot(cache, victim->key, victim->hash));
+        cache->evictions++;
+        slot = find_slot(cache, key, hash); // The shift may have moved the target slot
+    }
+
+    CacheEntry *entry = &cache->entries[position];
+    strcpy(entry->key, key);
+    entry->hash = hash;
+    entry->result = result;
+    entry->status = (signed char)status;
+    entry->referenced = 0;
+    cache->index[slot] = (int)position + 1;
+}
+
+CalcResult cached_parse_expression(ExpressionCache *cache, const char *expr,
+                                   double *result, char *error_msg)
+{
+    char key[CACHE_KEY_SIZE];
+    if (cache == NULL || cache->capacity == 0 || !expression_cache_key(expr, key))
+        return parse_expression(expr, result, error_msg);
+
+    CalcResult status;
+    if (expression_cache_lookup(cache, key, result, &status))
+    {
+        if (status != CALC_SUCCESS && error_msg != NULL)
+            strcpy(error_msg, calc_error_message(status));
+        return status;
+    }
+
+    status = parse_expression(expr, result, error_msg);
+    // Parse errors carry positions in the original text, so only results
+    // that are the same for every spelling of the key are cached
+    if (status != CALC_INVALID_INPUT)
+        expression_cache_insert(cache, key, status == CALC_SUCCESS ? *result : 0.0, status);
+    return status;
+}
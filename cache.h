@@ -0,0 +1,52 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include "calculator.h"
+
+#define DEFAULT_CACHE_CAPACITY 1024
+#define CACHE_KEY_SIZE 64 // Longer expressions bypass the cache
+
+// One cached evaluation, keyed by the expression without whitespace
+typedef struct
+{
+    char key[CACHE_KEY_SIZE];
+    unsigned int hash;
+    double result;
+    signed char status;       // CalcResult of the evaluation
+    unsigned char referenced; // CLOCK reference bit
+} CacheEntry;
+
+// Bounded result cache with CLOCK eviction. Entries live in a fixed array;
+// an open-addressed index maps key hashes to entry positions.
+typedef struct
+{
+    CacheEntry *entries;
+    size_t capacity; // Maximum entries; 0 disables the cache
+    size_t count;
+    size_t hand;     // Next CLOCK eviction candidate
+    int *index;      // Entry position + 1 per slot, 0 when empty
+    size_t index_mask;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} ExpressionCache;
+
+int expression_cache_init(ExpressionCache *cache, size_t capacity);
+void expression_cache_clear(ExpressionCache *cache);
+void expression_cache_free(ExpressionCache *cache);
+
+// Write the cache key for expr into key; returns 0 if expr cannot be cached
+// (too long, or whitespace that separates two parts of a token)
+int expression_cache_key(const char *expr, char *key);
+int expression_cache_lookup(ExpressionCache *cache, const char *key,
+                            double *result, CalcResult *status);
+void expression_cache_insert(ExpressionCache *cache, const char *key,
+                             double result, CalcResult status);
+
+// parse_expression with the cache in front of it. A NULL or disabled cache
+// evaluates directly.
+CalcResult cached_parse_expression(ExpressionCache *cache, const char *expr,
+                                   double *result, char *error_msg);
+
+#endif // CACHE_H
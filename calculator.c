@@ -4,64 +4,331 @@
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <float.h>
 #include "utils.h"
+#include "instrument.h"
 
-// Function to parse and return a number from the input string
-int get_number(char *prompt, int *start_idx, int len, double *number)
+// Operator precedence levels used by the expression parser
+#define PREC_ADDITIVE 1
+#define PREC_MULTIPLICATIVE 2
+#define PREC_POWER 3
+
+// Integer exponents up to this magnitude use repeated squaring; larger ones
+// go to libm, where squaring would accumulate too much rounding error
+#define POWER_SQUARING_LIMIT 64
+
+// Rows evaluated together by evaluate_expression_batch
+#define EVAL_BLOCK_SIZE 64
+
+// Guard against stack exhaustion on deeply nested input such as "((((...))))"
+#define MAX_NESTING_DEPTH 256
+
+// Parser state: a cursor over the caller's buffer, which is never copied
+typedef struct
+{
+    const char *input;        // Expression being parsed
+    int pos;                  // Current scan position
+    int depth;                // Current nesting depth (parentheses and unary signs)
+    int stack_depth;          // Evaluation stack depth after the code emitted so far
+    CompiledExpression *expr; // Bytecode output
+    char *error_msg;          // Optional caller buffer for diagnostics
+} ExprParser;
+
+static CalcResult parse_binary(ExprParser *parser, int min_prec);
+
+// Record a diagnostic message if the caller supplied a buffer
+static void set_error(ExprParser *parser, const char *format, ...)
+{
+    if (parser->error_msg == NULL)
+        return;
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(parser->error_msg, CALC_ERROR_MSG_SIZE, format, args);
+    va_end(args);
+}
+
+static void skip_whitespace(ExprParser *parser)
+{
+    while (isspace((unsigned char)parser->input[parser->pos]))
+    {
+        parser->pos++;
+    }
+}
+
+// Append an opcode and track its effect on the evaluation stack
+static CalcResult emit_op(ExprParser *parser, unsigned char op, int stack_effect)
 {
-    // Skip leading whitespace
-    while (*start_idx < len && isspace(prompt[*start_idx]))
+    CompiledExpression *expr = parser->expr;
+    if (expr->code_length >= MAX_EXPRESSION_CODE)
     {
-        (*start_idx)++;
+        set_error(parser, "Expression too long");
+        return CALC_INVALID_INPUT;
     }
+    expr->code[expr->code_length++] = op;
 
-    char num1[32] = {};
-    int num_idx = 0;
-    // Check for an optional minus sign
-    if (*start_idx < len && (prompt[*start_idx] == '-' || prompt[*start_idx] == '+'))
+    parser->stack_depth += stack_effect;
+    if (parser->stack_depth > expr->max_stack)
     {
-        num1[num_idx++] = prompt[*start_idx];
-        (*start_idx)++;
+        if (parser->stack_depth > MAX_EVAL_STACK)
+        {
+            set_error(parser, "Expression too complex");
+            return CALC_INVALID_INPUT;
+        }
+        expr->max_stack = parser->stack_depth;
     }
-    // num1[num_idx] = '\0';
+    return CALC_SUCCESS;
+}
 
-    // Check if the current character is a digit
-    if (*start_idx >= len || !isdigit(prompt[*start_idx]))
+// Add a value to the constant pool and emit the instruction that pushes it
+static CalcResult emit_constant(ExprParser *parser, double value)
+{
+    CompiledExpression *expr = parser->expr;
+    if (expr->constant_count >= MAX_EXPRESSION_CONSTANTS ||
+        expr->code_length + 2 > MAX_EXPRESSION_CODE)
     {
-        return -1; // Indicate error
+        set_error(parser, "Expression too long");
+        return CALC_INVALID_INPUT;
     }
+    expr->constants[expr->constant_count] = value;
+    CalcResult error = emit_op(parser, EXPR_OP_PUSH_CONST, 1);
+    if (error != CALC_SUCCESS)
+        return error;
+    expr->code[expr->code_length++] = (unsigned char)expr->constant_count++;
+    return CALC_SUCCESS;
+}
 
-    // Loop through and parse the digits to build the number
-    while (*start_idx < len && (isdigit(prompt[*start_idx]) || prompt[*start_idx] == '.'))
+// Scan an identifier and emit a load of the matching variable slot
+static CalcResult emit_variable(ExprParser *parser)
+{
+    CompiledExpression *expr = parser->expr;
+    const char *name = parser->input + parser->pos;
+    int len = 0;
+    while (isalnum((unsigned char)name[len]) || name[len] == '_')
+    {
+        len++;
+    }
+    if (len >= MAX_VARIABLE_NAME)
     {
-        num1[num_idx++] = prompt[*start_idx];
-        (*start_idx)++;
+        set_error(parser, "Variable name too long at position %d", parser->pos + 1);
+        return CALC_INVALID_INPUT;
     }
+    parser->pos += len;
 
-    *number = atof(num1);
-    return 0;
+    // Reuse the slot if the name was already seen
+    int slot = 0;
+    while (slot < expr->variable_count &&
+           !(strncmp(expr->variables[slot], name, len) == 0 && expr->variables[slot][len] == '\0'))
+    {
+        slot++;
+    }
+    if (slot == expr->variable_count)
+    {
+        if (expr->variable_count >= MAX_EXPRESSION_VARIABLES)
+        {
+            set_error(parser, "Too many variables");
+            return CALC_INVALID_INPUT;
+        }
+        memcpy(expr->variables[slot], name, len);
+        expr->variables[slot][len] = '\0';
+        expr->variable_count++;
+    }
+
+    if (expr->code_length + 2 > MAX_EXPRESSION_CODE)
+    {
+        set_error(parser, "Expression too long");
+        return CALC_INVALID_INPUT;
+    }
+    CalcResult error = emit_op(parser, EXPR_OP_LOAD_VAR, 1);
+    if (error != CALC_SUCCESS)
+        return error;
+    expr->code[expr->code_length++] = (unsigned char)slot;
+    return CALC_SUCCESS;
 }
 
-// Function to get the operator from the input string
-int get_operator(char *prompt, int *start_idx, int len, char *operator)
+// Function to parse a number at the current position.
+// Scans [digits][.digits][e[+-]digits] and converts it in the same pass,
+// without copying. Signs never reach here: parse_unary treats them as operators.
+static int get_number(ExprParser *parser, double *number)
 {
-    // Skip leading whitespace
-    while (*start_idx < len && isspace(prompt[*start_idx]))
+    const char *start = parser->input + parser->pos;
+
+    // The input is NUL-terminated and NUL ends any number, so no length is needed
+    size_t length = parse_double_prefix(start, SIZE_MAX, number);
+    if (length == 0)
     {
-        (*start_idx)++;
+        return -1;
     }
 
-    // Check if the current character is a valid operator
-    if (*start_idx < len && (prompt[*start_idx] == '+' || prompt[*start_idx] == '-' || prompt[*start_idx] == '*' || prompt[*start_idx] == '/' || prompt[*start_idx] == '^'))
+    parser->pos += (int)length;
+    return 0;
+}
+
+// Function to get the operator at the current position
+static int get_operator(ExprParser *parser, char *operator)
+{
+    skip_whitespace(parser);
+
+    char c = parser->input[parser->pos];
+    if (is_valid_operator(c))
     {
-        *operator = prompt[*start_idx];
-        (*start_idx)++;
+        *operator = c;
+        parser->pos++;
         return 0;
     }
-    else
+    return -1; // Indicate error
+}
+
+static int operator_precedence(char op)
+{
+    switch (op)
+    {
+    case '+':
+    case '-':
+        return PREC_ADDITIVE;
+    case '*':
+    case '/':
+        return PREC_MULTIPLICATIVE;
+    default:
+        return PREC_POWER;
+    }
+}
+
+static unsigned char operator_opcode(char op)
+{
+    switch (op)
+    {
+    case '+':
+        return EXPR_OP_ADD;
+    case '-':
+        return EXPR_OP_SUBTRACT;
+    case '*':
+        return EXPR_OP_MULTIPLY;
+    case '/':
+        return EXPR_OP_DIVIDE;
+    default:
+        return EXPR_OP_POWER;
+    }
+}
+
+// Parse a number, a parenthesised sub-expression or a signed operand
+static CalcResult parse_unary(ExprParser *parser)
+{
+    skip_whitespace(parser);
+
+    char c = parser->input[parser->pos];
+    if (c == '(' || c == '+' || c == '-')
+    {
+        if (parser->depth >= MAX_NESTING_DEPTH)
+        {
+            set_error(parser, "Expression nested too deeply");
+            return CALC_INVALID_INPUT;
+        }
+        parser->depth++;
+        parser->pos++;
+
+        CalcResult error;
+        if (c == '(')
+        {
+            error = parse_binary(parser, PREC_ADDITIVE);
+            if (error != CALC_SUCCESS)
+                return error;
+
+            skip_whitespace(parser);
+            if (parser->input[parser->pos] != ')')
+            {
+                set_error(parser, "Missing closing parenthesis");
+                return CALC_INVALID_INPUT;
+            }
+            parser->pos++;
+        }
+        else
+        {
+            // Unary signs bind looser than '^' so that -2^2 == -(2^2)
+            CompiledExpression *expr = parser->expr;
+            int operand_start = expr->code_length;
+            error = parse_binary(parser, PREC_POWER);
+            if (error != CALC_SUCCESS)
+                return error;
+
+            if (c == '-')
+            {
+                // Fold negated literals into the constant pool
+                if (expr->code_length == operand_start + 2 &&
+                    expr->code[operand_start] == EXPR_OP_PUSH_CONST)
+                {
+                    double *constant = &expr->constants[expr->code[operand_start + 1]];
+                    *constant = -*constant;
+                }
+                else
+                {
+                    error = emit_op(parser, EXPR_OP_NEGATE, 0);
+                    if (error != CALC_SUCCESS)
+                        return error;
+                }
+            }
+        }
+        parser->depth--;
+        return CALC_SUCCESS;
+    }
+
+    if (isalpha((unsigned char)c) || c == '_')
     {
-        return -1; // Indicate error
+        return emit_variable(parser);
+    }
+
+    double number;
+    if (get_number(parser, &number) != 0)
+    {
+        if (c == '\0')
+            set_error(parser, "Unexpected end of expression");
+        else
+            set_error(parser, "Invalid number format at position %d", parser->pos + 1);
+        return CALC_INVALID_INPUT;
+    }
+    if (!isfinite(number))
+    {
+        // e.g. 1e400: report it like any other result out of range
+        set_error(parser, "Number out of range at position %d", parser->pos + 1);
+        return CALC_OVERFLOW;
+    }
+    return emit_constant(parser, number);
+}
+
+// Precedence climbing: consume operators binding at least as tightly as min_prec
+static CalcResult parse_binary(ExprParser *parser, int min_prec)
+{
+    CalcResult error = parse_unary(parser);
+    if (error != CALC_SUCCESS)
+        return error;
+
+    while (1)
+    {
+        int op_pos = parser->pos;
+        char op;
+        if (get_operator(parser, &op) != 0)
+            break;
+
+        int prec = operator_precedence(op);
+        if (prec < min_prec)
+        {
+            parser->pos = op_pos; // Leave it for the caller
+            break;
+        }
+
+        // '^' is right-associative, everything else is left-associative
+        error = parse_binary(parser, op == '^' ? prec : prec + 1);
+        if (error != CALC_SUCCESS)
+            return error;
+
+        error = emit_op(parser, operator_opcode(op), -1);
+        if (error != CALC_SUCCESS)
+            return error;
     }
+
+    return CALC_SUCCESS;
 }
 
 // Function to perform addition operation
@@ -98,111 +365,515 @@ double divide(double a, double b, CalcResult *error)
     return a / b;
 }
 
-double power(double base, int exponent, CalcResult *error)
+// Integer exponent by repeated squaring: O(log n) multiplies instead of libm pow()
+static double power_by_squaring(double base, unsigned int exponent)
+{
+    double result = 1.0;
+    while (exponent != 0)
+    {
+        if (exponent & 1)
+            result *= base;
+        base *= base;
+        exponent >>= 1;
+    }
+    return result;
+}
+
+double power(double base, double exponent, CalcResult *error)
 {
     if (error == NULL)
         return 0.0;
 
-    // Check for invalid cases
-    if (exponent < 0)
+    if (isnan(base) || isnan(exponent))
     {
         *error = CALC_INVALID_INPUT;
         return 0.0;
     }
+    if (base == 0.0 && exponent < 0.0)
+    {
+        *error = CALC_DIVISION_BY_ZERO;
+        return 0.0;
+    }
+
+    double result;
+    if (fabs(exponent) <= POWER_SQUARING_LIMIT && exponent == (double)(int)exponent)
+    {
+        int e = (int)exponent;
+        result = power_by_squaring(base, e < 0 ? -e : e);
+        if (e < 0)
+        {
+            // Take the reciprocal; if the intermediate overflowed, let libm
+            // decide whether the true result is representable
+            result = isinf(result) ? pow(base, exponent) : 1.0 / result;
+        }
+    }
+    else
+    {
+        // Non-integer or large exponents go to libm explicitly
+        result = pow(base, exponent);
+        if (isnan(result))
+        {
+            *error = CALC_INVALID_INPUT; // e.g. negative base, fractional exponent
+            return 0.0;
+        }
+    }
+
+    // Range errors: a finite base overflowing to infinity, or a finite
+    // non-zero base underflowing to zero (inf ^ -1 is exactly 0)
+    if ((isinf(result) && !isinf(base)) || (result == 0.0 && base != 0.0 && !isinf(base)))
+    {
+        *error = CALC_OVERFLOW;
+        return 0.0;
+    }
 
     *error = CALC_SUCCESS;
-    return pow(base, exponent);
+    return result;
 }
 
-// Expression parsing with robust error handling
-CalcResult parse_expression(const char *input, double *result, char *error_msg)
+// Batch arithmetic kernels.
+// The vector loops use GCC vector extensions; on x86-64 every kernel is
+// cloned for AVX2 and the SSE2 baseline and the dynamic loader selects the
+// clone for the running CPU. Other compilers get the scalar loops only.
+#if defined(__GNUC__)
+#define CALC_HAVE_VECTOR_EXT 1
+#define CALC_VEC_WIDTH 4
+typedef double calc_vec __attribute__((vector_size(32)));
+typedef long long calc_mask __attribute__((vector_size(32)));
+#endif
+
+#if defined(CALC_HAVE_VECTOR_EXT) && defined(__x86_64__) && defined(__linux__)
+#define CALC_SIMD_DISPATCH __attribute__((target_clones("avx2", "default")))
+#else
+#define CALC_SIMD_DISPATCH
+#endif
+
+CALC_SIMD_DISPATCH
+void add_n(const double *a, const double *b, double *out, size_t n)
 {
-    if (input == NULL || result == NULL)
+    size_t i = 0;
+#ifdef CALC_HAVE_VECTOR_EXT
+    for (; i + CALC_VEC_WIDTH <= n; i += CALC_VEC_WIDTH)
+    {
+        calc_vec va, vb;
+        memcpy(&va, a + i, sizeof(va));
+        memcpy(&vb, b + i, sizeof(vb));
+        va = va + vb;
+        memcpy(out + i, &va, sizeof(va));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        out[i] = a[i] + b[i];
+    }
+}
+
+CALC_SIMD_DISPATCH
+void subtract_n(const double *a, const double *b, double *out, size_t n)
+{
+    size_t i = 0;
+#ifdef CALC_HAVE_VECTOR_EXT
+    for (; i + CALC_VEC_WIDTH <= n; i += CALC_VEC_WIDTH)
+    {
+        calc_vec va, vb;
+        memcpy(&va, a + i, sizeof(va));
+        memcpy(&vb, b + i, sizeof(vb));
+        va = va - vb;
+        memcpy(out + i, &va, sizeof(va));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        out[i] = a[i] - b[i];
+    }
+}
+
+CALC_SIMD_DISPATCH
+void multiply_n(const double *a, const double *b, double *out, size_t n)
+{
+    size_t i = 0;
+#ifdef CALC_HAVE_VECTOR_EXT
+    for (; i + CALC_VEC_WIDTH <= n; i += CALC_VEC_WIDTH)
+    {
+        calc_vec va, vb;
+        memcpy(&va, a + i, sizeof(va));
+        memcpy(&vb, b + i, sizeof(vb));
+        va = va * vb;
+        memcpy(out + i, &va, sizeof(va));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        out[i] = a[i] * b[i];
+    }
+}
+
+// Like divide(), lanes with a zero divisor produce 0.0.
+// Returns the number of such lanes.
+CALC_SIMD_DISPATCH
+size_t divide_n(const double *a, const double *b, double *out, size_t n)
+{
+    size_t errors = 0;
+    size_t i = 0;
+#ifdef CALC_HAVE_VECTOR_EXT
+    calc_vec zero = {0.0, 0.0, 0.0, 0.0};
+    calc_mask error_lanes = {0, 0, 0, 0};
+    for (; i + CALC_VEC_WIDTH <= n; i += CALC_VEC_WIDTH)
+    {
+        calc_vec va, vb;
+        memcpy(&va, a + i, sizeof(va));
+        memcpy(&vb, b + i, sizeof(vb));
+        calc_mask is_zero = (calc_mask)(vb == zero); // All ones where b == 0
+        va = (calc_vec)((calc_mask)(va / vb) & ~is_zero);
+        memcpy(out + i, &va, sizeof(va));
+        error_lanes -= is_zero;
+    }
+    for (int k = 0; k < CALC_VEC_WIDTH; k++)
+    {
+        errors += (size_t)error_lanes[k];
+    }
+#endif
+    for (; i < n; i++)
+    {
+        int is_zero = (b[i] == 0.0);
+        out[i] = is_zero ? 0.0 : a[i] / b[i];
+        errors += is_zero;
+    }
+    return errors;
+}
+
+// Small integer exponents use repeated squaring with all lanes in lock step.
+// A group of lanes that needs anything else (fractional or large exponents,
+// range errors) is recomputed with power(), so results match it exactly.
+// Failed lanes produce 0.0; returns the number of failed lanes.
+CALC_SIMD_DISPATCH
+size_t power_n(const double *base, const double *exponent, double *out, size_t n)
+{
+    size_t errors = 0;
+    size_t i = 0;
+#ifdef CALC_HAVE_VECTOR_EXT
+    const calc_vec limit = {POWER_SQUARING_LIMIT, POWER_SQUARING_LIMIT,
+                            POWER_SQUARING_LIMIT, POWER_SQUARING_LIMIT};
+    const calc_vec zero = {0.0, 0.0, 0.0, 0.0};
+    const calc_vec one = {1.0, 1.0, 1.0, 1.0};
+    const calc_mask sign_bit = {INT64_MIN, INT64_MIN, INT64_MIN, INT64_MIN};
+    const calc_vec max_finite = {DBL_MAX, DBL_MAX, DBL_MAX, DBL_MAX};
+    for (; i + CALC_VEC_WIDTH <= n; i += CALC_VEC_WIDTH)
+    {
+        calc_vec b, x, result = one;
+        memcpy(&b, base + i, sizeof(b));
+        memcpy(&x, exponent + i, sizeof(x));
+
+        // Lanes are eligible when the exponent is a small integer (NaN fails both tests)
+        calc_vec abs_x = (calc_vec)((calc_mask)x & ~sign_bit);
+        calc_mask eligible = (calc_mask)(abs_x <= limit);
+        calc_vec small_x = (calc_vec)((calc_mask)x & eligible);
+        calc_mask e = __builtin_convertvector(small_x, calc_mask);
+        eligible &= (calc_mask)(__builtin_convertvector(e, calc_vec) == x);
+
+        calc_mask negative = e >> 63; // All ones where e < 0
+        e = (e ^ negative) - negative;
+
+        calc_vec sq = b;
+        while (e[0] | e[1] | e[2] | e[3])
+        {
+            calc_mask odd = -(e & 1);
+            result = (calc_vec)(((calc_mask)(result * sq) & odd) | ((calc_mask)result & ~odd));
+            sq = sq * sq;
+            e >>= 1;
+        }
+        calc_vec reciprocal = one / result;
+        result = (calc_vec)(((calc_mask)reciprocal & negative) | ((calc_mask)result & ~negative));
+
+        // Anything unusual (ineligible lanes, NaN bases, zero or non-finite
+        // results) takes the scalar path. A NaN base with exponent 0 never
+        // enters the squaring loop, so its result alone does not show it.
+        calc_vec abs_result = (calc_vec)((calc_mask)result & ~sign_bit);
+        calc_mask unusual = ~eligible | ~(calc_mask)(abs_result <= max_finite) |
+                            (calc_mask)(result == zero) | (calc_mask)(b != b);
+        if (unusual[0] | unusual[1] | unusual[2] | unusual[3])
+        {
+            for (int k = 0; k < CALC_VEC_WIDTH; k++)
+            {
+                CalcResult error;
+                out[i + k] = power(base[i + k], exponent[i + k], &error);
+                errors += (error != CALC_SUCCESS);
+            }
+            continue;
+        }
+        memcpy(out + i, &result, sizeof(result));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        CalcResult error;
+        out[i] = power(base[i], exponent[i], &error);
+        errors += (error != CALC_SUCCESS);
+    }
+    return errors;
+}
+
+// Compile an expression to bytecode.
+// Single pass over the input; no heap allocation.
+CalcResult compile_expression(const char *input, CompiledExpression *expr, char *error_msg)
+{
+    if (input == NULL || expr == NULL)
     {
         return CALC_INVALID_INPUT;
     }
 
-    // Create working copy and remove spaces
-    char *expr_copy = safe_string_copy(input);
-    if (expr_copy == NULL)
+    expr->code_length = 0;
+    expr->constant_count = 0;
+    expr->variable_count = 0;
+    expr->max_stack = 0;
+
+    ExprParser parser = {input, 0, 0, 0, expr, error_msg};
+    skip_whitespace(&parser);
+    if (input[parser.pos] == '\0')
+    {
+        return CALC_INVALID_INPUT;
+    }
+
+    CalcResult error = parse_binary(&parser, PREC_ADDITIVE);
+    if (error != CALC_SUCCESS)
+    {
+        return error;
+    }
+
+    skip_whitespace(&parser);
+    char c = input[parser.pos];
+    if (c != '\0')
     {
+        if (c == ')')
+            set_error(&parser, "Unmatched closing parenthesis at position %d", parser.pos + 1);
+        else
+            set_error(&parser, "Unexpected character '%c' at position %d", c, parser.pos + 1);
         return CALC_INVALID_INPUT;
     }
-    remove_spaces(expr_copy);
 
-    if (strlen(expr_copy) == 0)
+    return CALC_SUCCESS;
+}
+
+// Run compiled bytecode on a small stack machine
+CalcResult evaluate_expression(const CompiledExpression *expr, double *result)
+{
+    return evaluate_expression_with(expr, NULL, result);
+}
+
+CalcResult evaluate_expression_with(const CompiledExpression *expr, const double *values,
+                                    double *result)
+{
+    if (expr == NULL || result == NULL || expr->code_length == 0)
+    {
+        return CALC_INVALID_INPUT;
+    }
+    if (values == NULL && expr->variable_count > 0)
     {
-        free(expr_copy);
         return CALC_INVALID_INPUT;
     }
 
-    // Find operator (skip first character if it 's a sign)
-    int op_pos = -1;
-    int start_pos = (expr_copy[0] == '+' || expr_copy[0] == '-') ? 1 : 0;
+    double stack[MAX_EVAL_STACK];
+    double *top = stack - 1; // Points at the topmost value
+    const unsigned char *ip = expr->code;
+    const unsigned char *end = expr->code + expr->code_length;
+    int division_by_zero = 0;
+    CalcResult error = CALC_SUCCESS;
 
-    int len = strlen(expr_copy);
-    for (int i = start_pos; i < len; i++)
+    while (ip < end)
     {
-        if (is_valid_operator(expr_copy[i]))
+        switch (*ip++)
         {
-            op_pos = i;
+        case EXPR_OP_PUSH_CONST:
+            *++top = expr->constants[*ip++];
+            break;
+        case EXPR_OP_LOAD_VAR:
+            *++top = values[*ip++];
+            break;
+        case EXPR_OP_NEGATE:
+            *top = -*top;
+            break;
+        case EXPR_OP_ADD:
+            top[-1] = add(top[-1], top[0]);
+            top--;
+            break;
+        case EXPR_OP_SUBTRACT:
+            top[-1] = subtract(top[-1], top[0]);
+            top--;
+            break;
+        case EXPR_OP_MULTIPLY:
+            top[-1] = multiply(top[-1], top[0]);
+            top--;
             break;
+        case EXPR_OP_DIVIDE:
+            // Accumulate the error instead of branching out of the loop
+            division_by_zero |= (top[0] == 0.0);
+            top[-1] = top[-1] / top[0];
+            top--;
+            break;
+        case EXPR_OP_POWER:
+            top[-1] = power(top[-1], top[0], &error);
+            top--;
+            if (error != CALC_SUCCESS)
+                return error;
+            break;
+        default:
+            return CALC_INVALID_INPUT;
         }
     }
 
-    if (op_pos == -1)
+    if (division_by_zero)
     {
-        free(expr_copy);
-        return CALC_INVALID_INPUT;
+        return CALC_DIVISION_BY_ZERO;
     }
+    *result = *top;
+    return CALC_SUCCESS;
+}
 
-    // Extract operands
-    char op = expr_copy[op_pos];
-    expr_copy[op_pos] = '\0'; // Split string at operator
-    char *num1_str = expr_copy;
-    char *num2_str = expr_copy + op_pos + 1;
+// Evaluate one block of rows. Every instruction runs over the whole block,
+// so the interpreter overhead is paid once per block instead of once per row.
+static void evaluate_block(const CompiledExpression *expr, const double *const *columns,
+                           size_t base, int count, double *out, unsigned char *failed)
+{
+    double stack[MAX_EVAL_STACK][EVAL_BLOCK_SIZE];
+    int sp = -1;
+    const unsigned char *ip = expr->code;
+    const unsigned char *end = expr->code + expr->code_length;
 
-    // Convert operands
-    double num1, num2;
-    if (!string_to_double(num1_str, &num1))
+    while (ip < end)
     {
-        // Append num1_str to the error message
-        snprintf(error_msg,100, "Invalid number format: %s", num1_str);
-        free(expr_copy);
-        return CALC_INVALID_INPUT;
+        unsigned char op = *ip++;
+        double *a = stack[sp > 0 ? sp - 1 : 0];
+        double *b = stack[sp > 0 ? sp : 0];
+        CalcResult error;
+        int i;
+
+        switch (op)
+        {
+        case EXPR_OP_PUSH_CONST:
+        {
+            double value = expr->constants[*ip++];
+            sp++;
+            for (i = 0; i < count; i++)
+                stack[sp][i] = value;
+            break;
+        }
+        case EXPR_OP_LOAD_VAR:
+            sp++;
+            memcpy(stack[sp], columns[*ip++] + base, count * sizeof(double));
+            break;
+        case EXPR_OP_NEGATE:
+            for (i = 0; i < count; i++)
+                b[i] = -b[i];
+            break;
+        case EXPR_OP_ADD:
+            for (i = 0; i < count; i++)
+                a[i] = a[i] + b[i];
+            sp--;
+            break;
+        case EXPR_OP_SUBTRACT:
+            for (i = 0; i < count; i++)
+                a[i] = a[i] - b[i];
+            sp--;
+            break;
+        case EXPR_OP_MULTIPLY:
+            for (i = 0; i < count; i++)
+                a[i] = a[i] * b[i];
+            sp--;
+            break;
+        case EXPR_OP_DIVIDE:
+            for (i = 0; i < count; i++)
+            {
+                failed[i] |= (b[i] == 0.0);
+                a[i] = a[i] / b[i];
+            }
+            sp--;
+            break;
+        case EXPR_OP_POWER:
+            for (i = 0; i < count; i++)
+            {
+                a[i] = power(a[i], b[i], &error);
+                failed[i] |= (error != CALC_SUCCESS);
+            }
+            sp--;
+            break;
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        out[i] = failed[i] ? NAN : stack[0][i];
+    }
+}
+
+// Evaluate a compiled expression over columnar inputs.
+// columns[i] holds n values for expr->variables[i]; failed rows are set to NAN.
+// Returns the number of rows that failed.
+size_t evaluate_expression_batch(const CompiledExpression *expr, const double *const *columns,
+                                 size_t n, double *out)
+{
+    if (expr == NULL || out == NULL || expr->code_length == 0 ||
+        (columns == NULL && expr->variable_count > 0))
+    {
+        return n;
     }
-    if (!string_to_double(num2_str, &num2))
+
+    size_t failures = 0;
+    for (size_t base = 0; base < n; base += EVAL_BLOCK_SIZE)
+    {
+        int count = (n - base < EVAL_BLOCK_SIZE) ? (int)(n - base) : EVAL_BLOCK_SIZE;
+        unsigned char failed[EVAL_BLOCK_SIZE] = {0};
+
+        evaluate_block(expr, columns, base, count, out + base, failed);
+        for (int i = 0; i < count; i++)
+        {
+            failures += failed[i];
+        }
+    }
+    return failures;
+}
+
+// Find the column index of a named variable, or -1 if the expression does not use it
+int find_expression_variable(const CompiledExpression *expr, const char *name)
+{
+    if (expr == NULL || name == NULL)
+        return -1;
+
+    for (int i = 0; i < expr->variable_count; i++)
+    {
+        if (strcmp(expr->variables[i], name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// Expression parsing with robust error handling
+static CalcResult compile_and_evaluate(const char *input, double *result, char *error_msg)
+{
+    if (input == NULL || result == NULL)
     {
-        snprintf(error_msg,100, "Invalid number format: %s", num2_str);
-        free(expr_copy);
         return CALC_INVALID_INPUT;
     }
 
-    // Perform operation
-    CalcResult error = CALC_SUCCESS;
-    switch (op)
+    CompiledExpression expr;
+    CalcResult error = compile_expression(input, &expr, error_msg);
+    if (error != CALC_SUCCESS)
     {
-    case '+':
-        *result = add(num1, num2);
-        break;
-    case '-':
-        *result = subtract(num1, num2);
-        break;
-    case '*':
-        *result = multiply(num1, num2);
-        break;
-    case '/':
-        *result = divide(num1, num2, &error);
-        break;
-    case '^':
-        *result = power(num1, num2, &error);
-        break;
-    default:
-        error = CALC_INVALID_INPUT;
+        return error;
+    }
+    if (expr.variable_count > 0)
+    {
+        if (error_msg != NULL)
+            snprintf(error_msg, CALC_ERROR_MSG_SIZE, "Unknown variable: %s", expr.variables[0]);
+        return CALC_INVALID_INPUT;
     }
+    return evaluate_expression(&expr, result);
+}
 
-    free(expr_copy);
-    return error;
+CalcResult parse_expression(const char *input, double *result, char *error_msg)
+{
+    uint64_t start = profile_ticks();
+    CalcResult status = compile_and_evaluate(input, result, error_msg);
+    profile_record(PROFILE_PARSE_EXPRESSION, start);
+    return status;
 }
 
 // Input validation functions
@@ -249,3 +920,21 @@ int is_valid_operator(char op)
     return (op == '+' || op == '-' || op == '*' || op == '/' ||
             op == '^');
 }
+
+// Human-readable description of an error code
+const char *calc_error_message(CalcResult code)
+{
+    switch (code)
+    {
+    case CALC_SUCCESS:
+        return "Success";
+    case CALC_DIVISION_BY_ZERO:
+        return "Division by zero!";
+    case CALC_INVALID_INPUT:
+        return "Invalid input or expression";
+    case CALC_OVERFLOW:
+        return "Numerical overflow";
+    default:
+        return "Unknown calculation error";
+    }
+}
@@ -1,17 +1,9 @@
 #ifndef CALCULATOR_H
 #define CALCULATOR_H
 
+#include <stddef.h>
 #include <time.h>
 
-// Structure to represent a single calculation
-typedef struct
-{
-    char *expression_str; // Store original user input
-    char *result;         // Store the output
-    time_t timestamp;     // Time when calculation was performed
-    int is_error;         // status flag: 0 for success , 1 for error
-} Calculation;
-
 // Error codes for calculator operations
 typedef enum
 {
@@ -21,15 +13,86 @@ typedef enum
     CALC_OVERFLOW = -3
 } CalcResult;
 
+// Structure to represent a single calculation.
+// The result is kept as a number; text is produced only for display and saving.
+typedef struct
+{
+    char *expression_str;        // Store original user input
+    double result;               // Numeric result (0.0 for errors)
+    time_t timestamp;            // Time when calculation was performed
+    unsigned int expression_len; // Length of expression_str
+    signed char status;          // CalcResult code: CALC_SUCCESS or the error
+} Calculation;
+
 // Public arithmetic functions
 double add(double a, double b);
 double subtract(double a, double b);
 double multiply(double a, double b);
 double divide(double a, double b, CalcResult *error);
-double power(double base, int exponent, CalcResult *error);
+// Small integer exponents (including negative ones) use repeated squaring;
+// anything else goes to libm. Range errors report CALC_OVERFLOW.
+double power(double base, double exponent, CalcResult *error);
+
+// Bytecode limits for compiled expressions
+#define MAX_EXPRESSION_CODE 256
+#define MAX_EXPRESSION_CONSTANTS 128
+#define MAX_EVAL_STACK 64
+#define MAX_EXPRESSION_VARIABLES 16
+#define MAX_VARIABLE_NAME 32
+
+// Stack machine instructions produced by compile_expression
+typedef enum
+{
+    EXPR_OP_PUSH_CONST = 0, // Followed by a one-byte constant pool index
+    EXPR_OP_LOAD_VAR,       // Followed by a one-byte variable index
+    EXPR_OP_NEGATE,
+    EXPR_OP_ADD,
+    EXPR_OP_SUBTRACT,
+    EXPR_OP_MULTIPLY,
+    EXPR_OP_DIVIDE,
+    EXPR_OP_POWER
+} ExprOpcode;
+
+// An expression compiled once and evaluated many times.
+// Self-contained and fixed-size, so it can be copied or stored freely.
+typedef struct
+{
+    int code_length;    // Bytes used in code
+    int constant_count; // Entries used in constants
+    int variable_count; // Entries used in variables
+    int max_stack;      // Deepest evaluation stack the code needs
+    unsigned char code[MAX_EXPRESSION_CODE];
+    double constants[MAX_EXPRESSION_CONSTANTS];
+    char variables[MAX_EXPRESSION_VARIABLES][MAX_VARIABLE_NAME]; // Names in first-use order
+} CompiledExpression;
+
+// Batch arithmetic over arrays (SIMD where available).
+// divide_n and power_n return the number of failed lanes instead of an
+// error code per element; failed lanes are written as 0.0.
+void add_n(const double *a, const double *b, double *out, size_t n);
+void subtract_n(const double *a, const double *b, double *out, size_t n);
+void multiply_n(const double *a, const double *b, double *out, size_t n);
+size_t divide_n(const double *a, const double *b, double *out, size_t n);
+size_t power_n(const double *base, const double *exponent, double *out, size_t n);
 
 // Expression parsing
+// Supports + - * / ^ (right-associative), unary signs and parentheses.
+// Numbers may carry a decimal exponent (1e-9, 2.5E+3).
+// error_msg, when not NULL, must hold at least CALC_ERROR_MSG_SIZE bytes.
+#define CALC_ERROR_MSG_SIZE 100
 CalcResult parse_expression(const char *input, double *result, char *error_msg);
+CalcResult compile_expression(const char *input, CompiledExpression *expr, char *error_msg);
+CalcResult evaluate_expression(const CompiledExpression *expr, double *result);
+
+// Variable binding: values[i] / columns[i] correspond to expr->variables[i]
+CalcResult evaluate_expression_with(const CompiledExpression *expr, const double *values,
+                                    double *result);
+size_t evaluate_expression_batch(const CompiledExpression *expr, const double *const *columns,
+                                 size_t n, double *out);
+int find_expression_variable(const CompiledExpression *expr, const char *name);
+
+// Error reporting
+const char *calc_error_message(CalcResult code);
 
 // Input validation
 int is_valid_number(const char *str);
@@ -0,0 +1,277 @@
+// Client and load generator for the calculator server (app --serve SOCKET).
+//
+//   calc_client SOCKET                 send stdin lines, print the responses
+//   calc_client SOCKET --load N [--connections C] [--window W]
+//                                      send N generated expressions over C
+//                                      connections, at most W in flight each
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define CLIENT_BUFFER_SIZE (64 * 1024)
+#define DEFAULT_LOAD_CONNECTIONS 8
+#define DEFAULT_LOAD_WINDOW 256
+#define MAX_LOAD_CONNECTIONS 1024
+
+static int connect_socket(const char *path)
+{
+    struct sockaddr_un address = {0};
+    if (strlen(path) >= sizeof(address.sun_path))
+        return -1;
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+// Forward stdin to the server and responses to stdout, both directions at once
+static int run_pipe(int fd)
+{
+    char outgoing[CLIENT_BUFFER_SIZE];
+    size_t pending = 0, sent = 0;
+    char incoming[CLIENT_BUFFER_SIZE];
+    int stdin_open = 1;
+
+    while (1)
+    {
+        // stdin is only read once the previous chunk is sent. A negative fd
+        // is ignored by poll; with events == 0 a closed pipe would still
+        // report POLLHUP.
+        struct pollfd fds[2] = {{fd, POLLIN, 0}, {-1, POLLIN, 0}};
+        if (sent < pending)
+            fds[0].events |= POLLOUT;
+        else if (stdin_open)
+            fds[1].fd = STDIN_FILENO;
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+
+        if (fds[1].fd >= 0 && (fds[1].revents & (POLLIN | POLLHUP)))
+        {
+            ssize_t got = read(STDIN_FILENO, outgoing, sizeof(outgoing));
+            if (got <= 0)
+            {
+                stdin_open = 0;
+                shutdown(fd, SHUT_WR); // The server answers what it has, then closes
+            }
+            else
+            {
+                pending = (size_t)got;
+                sent = 0;
+            }
+        }
+        if ((fds[0].revents & POLLOUT) && sent < pending)
+        {
+            ssize_t n = send(fd, outgoing + sent, pending - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno != EAGAIN)
+                return 1;
+            if (n > 0)
+                sent += (size_t)n;
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP))
+        {
+            ssize_t got = recv(fd, incoming, sizeof(incoming), 0);
+            if (got == 0)
+                return 0;
+            if (got < 0 && errno != EAGAIN)
+                return 1;
+            if (got > 0)
+                fwrite(incoming, 1, (size_t)got, stdout);
+        }
+    }
+}
+
+// Load generator state for one connection
+typedef struct
+{
+    int fd;
+    long first;    // First request number of this connection
+    long next;     // Next request number to send
+    long end;      // One past the last request number
+    long answered; // Responses received
+    long errors;   // Responses that were not the expected number
+    char out[CLIENT_BUFFER_SIZE];
+    size_t out_length, out_sent;
+    char in[CLIENT_BUFFER_SIZE];
+    size_t in_length;
+} LoadConnection;
+
+// Queue requests while fewer than window are unanswered
+static void queue_requests(LoadConnection *conn, long window)
+{
+    if (conn->out_sent == conn->out_length)
+        conn->out_length = conn->out_sent = 0;
+    while (conn->next < conn->end && conn->next - conn->first - conn->answered < window &&
+           conn->out_length + 64 < sizeof(conn->out))
+    {
+        conn->out_length += (size_t)snprintf(conn->out + conn->out_length, 64, "%ld * 3 + 1\n", conn->next);
+        conn->next++;
+    }
+}
+
+// Check each complete response line against the expected result
+static void check_responses(LoadConnection *conn)
+{
+    size_t start = 0;
+    char *newline;
+    while ((newline = memchr(conn->in + start, '\n', conn->in_length - start)) != NULL)
+    {
+        *newline = '\0';
+        long expected = (conn->first + conn->answered) * 3 + 1;
+        if (strtol(conn->in + start, NULL, 10) != expected || strncmp(conn->in + start, "ERROR", 5) == 0)
+            conn->errors++;
+        conn->answered++;
+        start = newline + 1 - conn->in;
+    }
+    memmove(conn->in, conn->in + start, conn->in_length - start);
+    conn->in_length -= start;
+}
+
+static int run_load(const char *path, long requests, int connections, long window)
+{
+    LoadConnection *conns = calloc(connections, sizeof(LoadConnection));
+    struct pollfd *fds = calloc(connections, sizeof(struct pollfd));
+    if (conns == NULL || fds == NULL)
+        return 1;
+
+    for (int i = 0; i < connections; i++)
+    {
+        conns[i].fd = connect_socket(path);
+        if (conns[i].fd < 0)
+        {
+            fprintf(stderr, "Error : Cannot connect to %s\n", path);
+            return 1;
+        }
+        conns[i].first = requests * i / connections;
+        conns[i].next = conns[i].first;
+        conns[i].end = requests * (i + 1) / connections;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int remaining = connections;
+    for (int i = 0; i < connections; i++)
+    {
+        if (conns[i].end == conns[i].first)
+        {
+            close(conns[i].fd); // Fewer requests than connections
+            conns[i].fd = -1;
+            remaining--;
+        }
+    }
+    while (remaining > 0)
+    {
+        for (int i = 0; i < connections; i++)
+        {
+            LoadConnection *conn = &conns[i];
+            queue_requests(conn, window);
+            fds[i].fd = conn->fd;
+            fds[i].events = POLLIN | (conn->out_sent < conn->out_length ? POLLOUT : 0);
+        }
+        if (poll(fds, connections, -1) < 0 && errno != EINTR)
+            return 1;
+
+        for (int i = 0; i < connections; i++)
+        {
+            LoadConnection *conn = &conns[i];
+            if (fds[i].fd < 0)
+                continue;
+            if (fds[i].revents & POLLOUT)
+            {
+                ssize_t n = send(conn->fd, conn->out + conn->out_sent, conn->out_length - conn->out_sent, MSG_NOSIGNAL);
+                if (n > 0)
+                    conn->out_sent += (size_t)n;
+            }
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                ssize_t got = recv(conn->fd, conn->in + conn->in_length, sizeof(conn->in) - conn->in_length, 0);
+                if (got <= 0 && !(got < 0 && errno == EAGAIN))
+                {
+                    fprintf(stderr, "Error : Connection %d closed early\n", i);
+                    return 1;
+                }
+                if (got > 0)
+                {
+                    conn->in_length += (size_t)got;
+                    check_responses(conn);
+                }
+            }
+            if (conn->answered == conn->end - conn->first)
+            {
+                close(conn->fd);
+                conn->fd = -1;
+                remaining--;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    long errors = 0;
+    for (int i = 0; i < connections; i++)
+        errors += conns[i].errors;
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%ld requests over %d connections in %.3f s: %.0f requests/s, %ld wrong\n",
+           requests, connections, seconds, seconds > 0 ? requests / seconds : 0.0, errors);
+    free(conns);
+    free(fds);
+    return errors > 0 ? 2 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s SOCKET [--load N [--connections C] [--window W]]\n", argv[0]);
+        return 1;
+    }
+
+    long requests = 0;
+    long connections = DEFAULT_LOAD_CONNECTIONS;
+    long window = DEFAULT_LOAD_WINDOW;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--load") == 0)
+            requests = atol(argv[i + 1]);
+        else if (strcmp(argv[i], "--connections") == 0)
+            connections = atol(argv[i + 1]);
+        else if (strcmp(argv[i], "--window") == 0)
+            window = atol(argv[i + 1]);
+    }
+    if (connections < 1 || connections > MAX_LOAD_CONNECTIONS || window < 1)
+    {
+        fprintf(stderr, "Error : Invalid --connections or --window\n");
+        return 1;
+    }
+
+    if (requests > 0)
+        return run_load(argv[1], requests, (int)connections, window);
+
+    int fd = connect_socket(argv[1]);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error : Cannot connect to %s\n", argv[1]);
+        return 1;
+    }
+    int status = run_pipe(fd);
+    close(fd);
+    return status;
+}
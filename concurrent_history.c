@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <string.h>
+#include "concurrent_history.h"
+#include "history.h"
+#include "utils.h"
+
+// Stands in for an expression that could not be copied
+static char lost_expression[1];
+
+void concurrent_history_init(ConcurrentHistory *hist)
+{
+    for (int k = 0; k < CONCURRENT_HISTORY_MAX_SEGMENTS; k++)
+        atomic_init(&hist->segments[k], NULL);
+    atomic_init(&hist->reserved, 0);
+    atomic_init(&hist->published, 0);
+    atomic_init(&hist->failed, 0);
+}
+
+// Only call once no other thread is using the history
+void concurrent_history_free(ConcurrentHistory *hist)
+{
+    int count = atomic_load(&hist->reserved);
+    for (int k = 0; k < CONCURRENT_HISTORY_MAX_SEGMENTS; k++)
+    {
+        ConcurrentEntry *segment = atomic_load(&hist->segments[k]);
+        if (segment == NULL)
+            continue;
+        size_t first = (size_t)CONCURRENT_HISTORY_FIRST_SEGMENT * ((1u << k) - 1);
+        size_t size = (size_t)CONCURRENT_HISTORY_FIRST_SEGMENT << k;
+        for (size_t i = 0; i < size && first + i < (size_t)count; i++)
+        {
+            if (segment[i].calc.expression_str != lost_expression)
+                safe_free(segment[i].calc.expression_str);
+        }
+        safe_free(segment);
+    }
+    concurrent_history_init(hist);
+}
+
+// Segment and offset of an index: segment k starts at FIRST * (2^k - 1)
+static int locate(int index, size_t *offset)
+{
+    unsigned long long scaled = (unsigned long long)index / CONCURRENT_HISTORY_FIRST_SEGMENT + 1;
+    int k = 63 - __builtin_clzll(scaled);
+    *offset = (size_t)index - (size_t)CONCURRENT_HISTORY_FIRST_SEGMENT * ((1ull << k) - 1);
+    return k;
+}
+
+// The segment for k, allocating it if no other thread has yet
+static ConcurrentEntry *get_segment(ConcurrentHistory *hist, int k)
+{
+    ConcurrentEntry *segment = atomic_load_explicit(&hist->segments[k], memory_order_acquire);
+    if (segment != NULL)
+        return segment;
+
+    ConcurrentEntry *fresh = safe_calloc((size_t)CONCURRENT_HISTORY_FIRST_SEGMENT << k, sizeof(ConcurrentEntry));
+    if (fresh == NULL)
+        return NULL;
+    if (atomic_compare_exchange_strong_explicit(&hist->segments[k], &segment, fresh,
+                                                memory_order_acq_rel, memory_order_acquire))
+        return fresh;
+    safe_free(fresh); // Lost the race; segment now holds the winner's
+    return segment;
+}
+
+static ConcurrentEntry *entry_at(const ConcurrentHistory *hist, int index)
+{
+    size_t offset;
+    int k = locate(index, &offset);
+    ConcurrentEntry *segment = atomic_load_explicit(&((ConcurrentHistory *)hist)->segments[k],
+                                                    memory_order_acquire);
+    return segment != NULL ? &segment[offset] : NULL;
+}
+
+// Move the published count past every completed entry. Whichever appender
+// finds the next entry ready advances it, so no one waits for a slow writer.
+// The ready flags are stored and loaded sequentially consistent: each
+// appender sets its own flag and then reads the others', and with weaker
+// orderings two appenders could both miss each other's flag, leaving the
+// later entry unpublished.
+static void publish(ConcurrentHistory *hist)
+{
+    int published = atomic_load(&hist->published);
+    while (published < atomic_load(&hist->reserved))
+    {
+        ConcurrentEntry *entry = entry_at(hist, published);
+        if (entry == NULL || !atomic_load(&entry->ready))
+            return; // That appender publishes when it finishes
+        if (atomic_compare_exchange_weak(&hist->published, &published, published + 1))
+            published++;
+    }
+}
+
+int concurrent_history_append(ConcurrentHistory *hist, const char *expr, double result,
+                              CalcResult status)
+{
+    if (hist == NULL || expr == NULL || atomic_load(&hist->failed))
+        return -1;
+
+    int index = atomic_fetch_add_explicit(&hist->reserved, 1, memory_order_acq_rel);
+    size_t offset;
+    int k = locate(index, &offset);
+    ConcurrentEntry *segment = k < CONCURRENT_HISTORY_MAX_SEGMENTS ? get_segment(hist, k) : NULL;
+    if (segment == NULL)
+    {
+        // The slot is never published, and neither is anything after it
+        int failed = atomic_load(&hist->failed);
+        while ((failed == 0 || index + 1 < failed) &&
+               !atomic_compare_exchange_weak(&hist->failed, &failed, index + 1))
+            ;
+        return -1;
+    }
+
+    ConcurrentEntry *entry = &segment[offset];
+    size_t length = strlen(expr);
+    char *copy = safe_malloc(length + 1);
+    if (copy != NULL)
+    {
+        memcpy(copy, expr, length + 1);
+    }
+    else
+    {
+        // Publish an empty entry rather than stall every later one
+        copy = lost_expression;
+        length = 0;
+    }
+    entry->calc.expression_str = copy;
+    entry->calc.expression_len = (unsigned int)length;
+    entry->calc.result = status == CALC_SUCCESS ? result : 0.0;
+    entry->calc.status = (signed char)status;
+    entry->calc.timestamp = time(NULL);
+    atomic_store(&entry->ready, 1);
+
+    publish(hist);
+    // An earlier slot without memory keeps this entry from ever being published
+    int failed = atomic_load(&hist->failed);
+    if (failed != 0 && index >= failed)
+        return -1;
+    return copy != lost_expression ? index : -1;
+}
+
+int concurrent_history_count(const ConcurrentHistory *hist)
+{
+    return atomic_load_explicit(&((ConcurrentHistory *)hist)->published, memory_order_acquire);
+}
+
+const Calculation *concurrent_history_get(const ConcurrentHistory *hist, int index)
+{
+    if (hist == NULL || index < 0 || index >= concurrent_history_count(hist))
+        return NULL;
+    return &entry_at(hist, index)->calc;
+}
+
+void display_concurrent_history(const ConcurrentHistory *hist)
+{
+    // Entries appended while we print are left for the next call
+    int count = concurrent_history_count(hist);
+    printf("Calculation History (%d entries):\n", count);
+    fflush(stdout);
+
+    OutputBuffer out;
+    TimestampCache times;
+    if (!output_buffer_init(&out, stdout, DISPLAY_BUFFER_SIZE))
+        return;
+    timestamp_cache_init(&times);
+    for (int i = 0; i < count; i++)
+    {
+        write_calculation(&out, &times, &entry_at(hist, i)->calc, i + 1);
+    }
+    output_buffer_flush(&out);
+    output_buffer_free(&out);
+}
+
+CalcResult replay_concurrent_calculation(const ConcurrentHistory *hist, int index, double *result)
+{
+    const Calculation *calc = concurrent_history_get(hist, index);
+    if (calc == NULL || result == NULL)
+        return CALC_INVALID_INPUT;
+    return parse_expression(calc->expression_str, result, NULL);
+}
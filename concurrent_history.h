@@ -0,0 +1,44 @@
+#ifndef CONCURRENT_HISTORY_H
+#define CONCURRENT_HISTORY_H
+
+#include <stdatomic.h>
+#include "calculator.h"
+
+// Segment k holds CONCURRENT_HISTORY_FIRST_SEGMENT << k entries, so
+// CONCURRENT_HISTORY_MAX_SEGMENTS segments cover any int index
+#define CONCURRENT_HISTORY_FIRST_SEGMENT 64
+#define CONCURRENT_HISTORY_MAX_SEGMENTS 26
+
+typedef struct
+{
+    Calculation calc;
+    atomic_int ready; // Set once calc is fully written
+} ConcurrentEntry;
+
+// History that any number of threads may append to and read at the same
+// time without locks. Entries live in segments that are never moved or
+// freed before concurrent_history_free, so pointers to them stay valid.
+typedef struct
+{
+    _Atomic(ConcurrentEntry *) segments[CONCURRENT_HISTORY_MAX_SEGMENTS];
+    atomic_int reserved;  // Slots handed out to appenders
+    atomic_int published; // Entries [0, published) are complete
+    atomic_int failed;    // 1 + first slot that never got memory (nothing from it on is published), or 0
+} ConcurrentHistory;
+
+void concurrent_history_init(ConcurrentHistory *hist);
+void concurrent_history_free(ConcurrentHistory *hist);
+
+// Append an entry; returns its index, or -1 if memory ran out. Once a
+// segment cannot be allocated, that append and every later one return -1.
+int concurrent_history_append(ConcurrentHistory *hist, const char *expr, double result,
+                              CalcResult status);
+
+// Readers see every entry below the published count, complete and unchanging
+int concurrent_history_count(const ConcurrentHistory *hist);
+const Calculation *concurrent_history_get(const ConcurrentHistory *hist, int index);
+
+void display_concurrent_history(const ConcurrentHistory *hist);
+CalcResult replay_concurrent_calculation(const ConcurrentHistory *hist, int index, double *result);
+
+#endif // CONCURRENT_HISTORY_H
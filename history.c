@@ -1,7 +1,17 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "history.h"
+#include "utils.h"
+#include "thread_pool.h"
+#include "instrument.h"
 
 HistoryResult init_history(CalculationHistory *hist)
 {
@@ -11,9 +21,19 @@ HistoryResult init_history(CalculationHistory *hist)
     // Start with initial capacity
     hist->capacity = INITIAL_HISTORY_CAPACITY;
     hist->count = 0;
+    hist->first_resident = 0;
+    hist->memory_limit = 0;
+    hist->verbose = HISTORY_VERBOSE_INFO;
+    hist->growth_factor = HISTORY_GROWTH_FACTOR;
+    arena_init(&hist->strings, ARENA_CHUNK_SIZE);
+    fixed_pool_init(&hist->postings_pool, HISTORY_INDEX_POSTINGS_BLOCK);
+    history_index_init(&hist->index, fixed_pool_allocator(&hist->postings_pool));
+    hist->index_complete = 1;
+    hist->timestamps_sorted = 1;
+    hist->journal = NULL;
 
     // Allocate memory for the array
-    hist->calculations = malloc(hist->capacity * sizeof(Calculation));
+    hist->calculations = safe_malloc(hist->capacity * sizeof(Calculation));
     if (hist->calculations == NULL)
     {
         return HISTORY_MEMORY_ERROR;
@@ -22,216 +42,1505 @@ HistoryResult init_history(CalculationHistory *hist)
     return HISTORY_SUCCESS;
 }
 
+// Slices of one CSV record. The pointers refer to the caller's buffer, which
+// need not be NUL-terminated; quoted fields may still contain "" escapes.
+typedef struct
+{
+    time_t timestamp;
+    const char *expression;
+    size_t expression_len;
+    int expression_quoted;
+    const char *result;
+    size_t result_len;
+    int result_quoted;
+    int is_error;
+} CsvRecord;
+
+// Read-only view of a whole file
+typedef struct
+{
+    const char *data;
+    size_t size;
+    int mapped; // 1 if data comes from mmap, 0 if it was read into memory
+} FileView;
+
+// Collapse "" escapes of a quoted CSV field in place; returns the new length
+static size_t unescape_csv_field(char *field, size_t len)
+{
+    size_t j = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        field[j++] = field[i];
+        if (field[i] == '"' && i + 1 < len && field[i + 1] == '"')
+            i++;
+    }
+    field[j] = '\0';
+    return j;
+}
+
+// Copy a field slice into a new NUL-terminated string
+static char *copy_field(const char *field, size_t len, int quoted)
+{
+    char *copy = safe_malloc(len + 1);
+    if (copy == NULL)
+        return NULL;
+    memcpy(copy, field, len);
+    copy[len] = '\0';
+    if (quoted)
+        unescape_csv_field(copy, len);
+    return copy;
+}
+
+// Text shown and saved for an entry's result
+static const char *result_text(const Calculation *calc, char *buffer, size_t size)
+{
+    if (calc->status != CALC_SUCCESS)
+        return calc_error_message((CalcResult)calc->status);
+    format_double(calc->result, buffer, size);
+    return buffer;
+}
+
+// Write a quoted CSV field, doubling any embedded quotes
+static void write_csv_field(FILE *file, const char *text)
+{
+    fputc('"', file);
+    for (const char *p = text; *p != '\0'; p++)
+    {
+        if (*p == '"')
+            fputc('"', file);
+        fputc(*p, file);
+    }
+    fputc('"', file);
+}
+
+// Write one entry in the CSV record format. The Error column holds the
+// CalcResult code (0 on success); older files used 1 for any error.
+static void write_csv_record(FILE *file, const Calculation *calc)
+{
+    char number[DOUBLE_STRING_SIZE];
+    fprintf(file, "%ld,", (long)calc->timestamp);
+    write_csv_field(file, calc->expression_str);
+    fputc(',', file);
+    write_csv_field(file, result_text(calc, number, sizeof(number)));
+    fprintf(file, ",%d\n", calc->status);
+}
+
+// Turn the Result and Error columns of a record back into a value and status
+static void decode_csv_result(const CsvRecord *rec, double *value, CalcResult *status)
+{
+    *value = 0.0;
+    if (rec->is_error < 0)
+    {
+        *status = (CalcResult)rec->is_error;
+        return;
+    }
+    if (rec->is_error > 0)
+    {
+        // Legacy error entry: recover the code from its message
+        *status = CALC_INVALID_INPUT;
+        const CalcResult codes[] = {CALC_DIVISION_BY_ZERO, CALC_OVERFLOW};
+        for (size_t i = 0; i < sizeof(codes) / sizeof(codes[0]); i++)
+        {
+            const char *message = calc_error_message(codes[i]);
+            if (rec->result_len == strlen(message) &&
+                memcmp(rec->result, message, rec->result_len) == 0)
+            {
+                *status = codes[i];
+            }
+        }
+        return;
+    }
+
+    *status = span_to_double(rec->result, rec->result_len, value) ? CALC_SUCCESS : CALC_INVALID_INPUT;
+}
+
+// Start of a block in the journal file
+typedef struct
+{
+    int first;    // Number of the block's first entry
+    off_t offset; // File offset of the block header
+} JournalCheckpoint;
+
+// Block of evicted entries read back from the journal file
+typedef struct
+{
+    int first;            // Entry number of entries[0]
+    int count;            // 0 when nothing is paged in
+    off_t end;            // File offset just past the block
+    Calculation *entries;
+    int capacity;
+    ByteBuffer payload;   // The block as read
+    ByteBuffer text;      // NUL-terminated expressions of entries
+} JournalPage;
+
+// Append-only persistence state (see attach_history_journal)
+struct HistoryJournal
+{
+    FILE *file;        // Append handle
+    char *path;        // File being appended to
+    ByteBuffer block;  // Records encoded since the last block was written
+    int pending;       // Records in block
+    int sync_interval; // Records per block and fsync; 0 only on flush
+
+    // Entry directory, kept while the file is known to hold exactly the
+    // entries in order (see set_history_memory_limit)
+    int indexed;
+    int written;                    // Entries in the file
+    off_t size;                     // File size: where the next block goes
+    JournalCheckpoint *checkpoints; // At least HISTORY_BLOCK_RECORDS entries apart
+    int checkpoint_count;
+    int checkpoint_capacity;
+    int fd;                         // Read handle for paging, or -1
+    JournalPage page;
+};
+
+// Little-endian field encoding, independent of the host byte order
+static void put_u32(unsigned char *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static void put_u64(unsigned char *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint32_t get_u32(const unsigned char *p)
+{
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static uint64_t get_u64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+// CRC-32 (IEEE 802.3) over a block payload
+static uint32_t crc32_bytes(const unsigned char *data, size_t length)
+{
+    static uint32_t table[256];
+    static int table_ready = 0;
+    if (!table_ready)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+            for (int k = 0; k < 8; k++)
+                crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+            table[i] = crc;
+        }
+        table_ready = 1;
+    }
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Append one record to a block payload
+static int encode_record(ByteBuffer *buf, const Calculation *calc)
+{
+    if (!byte_buffer_reserve(buf, HISTORY_RECORD_HEADER_SIZE + calc->expression_len))
+        return 0;
+
+    unsigned char *p = buf->data + buf->length;
+    uint64_t result_bits;
+    memcpy(&result_bits, &calc->result, sizeof(result_bits));
+    put_u64(p, (uint64_t)(int64_t)calc->timestamp);
+    put_u64(p + 8, result_bits);
+    p[16] = (unsigned char)calc->status;
+    put_u32(p + 17, calc->expression_len);
+    memcpy(p + HISTORY_RECORD_HEADER_SIZE, calc->expression_str, calc->expression_len);
+    buf->length += HISTORY_RECORD_HEADER_SIZE + calc->expression_len;
+    return 1;
+}
+
+static int write_file_header(FILE *file)
+{
+    unsigned char header[HISTORY_FILE_HEADER_SIZE] = {0};
+    memcpy(header, HISTORY_FILE_MAGIC, 8);
+    put_u32(header + 8, HISTORY_FILE_VERSION);
+    return fwrite(header, sizeof(header), 1, file) == 1;
+}
+
+// Write a block header and payload; the caller resets the payload
+static int write_block(FILE *file, const ByteBuffer *payload, int record_count)
+{
+    unsigned char header[HISTORY_BLOCK_HEADER_SIZE];
+    put_u32(header, (uint32_t)record_count);
+    put_u32(header + 4, (uint32_t)payload->length);
+    put_u32(header + 8, crc32_bytes(payload->data, payload->length));
+    if (fwrite(header, sizeof(header), 1, file) != 1)
+        return 0;
+    return payload->length == 0 || fwrite(payload->data, payload->length, 1, file) == 1;
+}
+
+// Forget the entry directory and the paged block
+static void drop_directory(HistoryJournal *journal)
+{
+    journal->indexed = 0;
+    journal->written = 0;
+    journal->checkpoint_count = 0;
+    journal->page.count = 0;
+}
+
+// Enter a block of records written at offset into the directory
+static int note_block(HistoryJournal *journal, off_t offset, int records)
+{
+    int count = journal->checkpoint_count;
+    if (count == 0 || journal->written - journal->checkpoints[count - 1].first >= HISTORY_BLOCK_RECORDS)
+    {
+        if (count == journal->checkpoint_capacity)
+        {
+            int capacity = count > 0 ? count * 2 : 16;
+            JournalCheckpoint *grown = safe_realloc(journal->checkpoints,
+                                                    (size_t)capacity * sizeof(JournalCheckpoint));
+            if (grown == NULL)
+                return 0;
+            journal->checkpoints = grown;
+            journal->checkpoint_capacity = capacity;
+        }
+        journal->checkpoints[count].first = journal->written;
+        journal->checkpoints[count].offset = offset;
+        journal->checkpoint_count++;
+    }
+    journal->written += records;
+    return 1;
+}
+
+// Walk the block headers of the journal file into a new directory. Succeeds
+// only when the file holds exactly expected records and nothing after them,
+// so entry numbers in memory and on disk agree.
+static int build_directory(HistoryJournal *journal, int expected)
+{
+    drop_directory(journal);
+    if (journal->fd >= 0)
+        close(journal->fd);
+    journal->fd = open(journal->path, O_RDONLY);
+    struct stat st;
+    unsigned char header[HISTORY_FILE_HEADER_SIZE];
+    if (journal->fd < 0 || fstat(journal->fd, &st) != 0 ||
+        pread(journal->fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header, HISTORY_FILE_MAGIC, 8) != 0)
+    {
+        return 0;
+    }
+
+    off_t offset = HISTORY_FILE_HEADER_SIZE;
+    while (offset < st.st_size)
+    {
+        if (pread(journal->fd, header, HISTORY_BLOCK_HEADER_SIZE, offset) != HISTORY_BLOCK_HEADER_SIZE ||
+            get_u32(header + 4) > st.st_size - offset - HISTORY_BLOCK_HEADER_SIZE ||
+            get_u32(header) > (uint32_t)INT_MAX - (uint32_t)journal->written ||
+            !note_block(journal, offset, (int)get_u32(header)))
+        {
+            drop_directory(journal);
+            return 0;
+        }
+        offset += HISTORY_BLOCK_HEADER_SIZE + get_u32(header + 4);
+    }
+    if (journal->written != expected)
+    {
+        drop_directory(journal);
+        return 0;
+    }
+    journal->size = offset;
+    journal->indexed = 1;
+    return 1;
+}
+
+// Write out the pending block and make it durable
+static HistoryResult journal_flush(HistoryJournal *journal)
+{
+    int ok = 1;
+    int records = journal->pending;
+    off_t bytes = HISTORY_BLOCK_HEADER_SIZE + (off_t)journal->block.length;
+    if (records > 0)
+        ok = write_block(journal->file, &journal->block, records);
+    journal->block.length = 0;
+    journal->pending = 0;
+    ok = ok && fflush(journal->file) == 0;
+
+    // Keep the directory in step with the file
+    if (records > 0 && journal->indexed)
+    {
+        if (ok && note_block(journal, journal->size, records))
+            journal->size += bytes;
+        else
+            drop_directory(journal);
+    }
+    if (!ok || fsync(fileno(journal->file)) != 0)
+        return HISTORY_FILE_ERROR;
+    return HISTORY_SUCCESS;
+}
+
+// Read the block holding evicted entry index into the page; the directory
+// must be valid. Sequential reads carry on from the block already paged in
+// instead of walking forward from a checkpoint again.
+static const Calculation *journal_page_in(HistoryJournal *journal, int index)
+{
+    JournalPage *page = &journal->page;
+    if (index >= page->first && index < page->first + page->count)
+        return &page->entries[index - page->first];
+    if (journal->checkpoint_count == 0)
+        return NULL;
+
+    // Last checkpoint at or before index
+    int lo = 0, hi = journal->checkpoint_count;
+    while (hi - lo > 1)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (journal->checkpoints[mid].first <= index)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    int entry = journal->checkpoints[lo].first;
+    off_t offset = journal->checkpoints[lo].offset;
+    int page_end = page->first + page->count;
+    if (page->count > 0 && page_end > entry && page_end <= index)
+    {
+        entry = page_end;
+        offset = page->end;
+    }
+
+    unsigned char header[HISTORY_BLOCK_HEADER_SIZE];
+    uint32_t records, size;
+    for (;;)
+    {
+        if (offset >= journal->size ||
+            pread(journal->fd, header, sizeof(header), offset) != (ssize_t)sizeof(header))
+        {
+            return NULL;
+        }
+        records = get_u32(header);
+        size = get_u32(header + 4);
+        if ((uint32_t)(index - entry) < records)
+            break;
+        entry += (int)records;
+        offset += HISTORY_BLOCK_HEADER_SIZE + size;
+    }
+
+    // Every record header is longer than a NUL, so size bytes of text are enough
+    page->count = 0;
+    page->payload.length = 0;
+    page->text.length = 0;
+    if (!byte_buffer_reserve(&page->payload, size) || !byte_buffer_reserve(&page->text, size))
+        return NULL;
+    if ((int)records > page->capacity)
+    {
+        Calculation *grown = safe_realloc(page->entries, records * sizeof(Calculation));
+        if (grown == NULL)
+            return NULL;
+        page->entries = grown;
+        page->capacity = (int)records;
+    }
+    if (pread(journal->fd, page->payload.data, size, offset + HISTORY_BLOCK_HEADER_SIZE) != (ssize_t)size)
+        return NULL;
+    if (crc32_bytes(page->payload.data, size) != get_u32(header + 8))
+    {
+        fprintf(stderr, "Warning : Checksum mismatch in %s; entry %d is unreadable\n", journal->path,
+                index + 1);
+        return NULL;
+    }
+
+    const unsigned char *record = page->payload.data;
+    const unsigned char *payload_end = record + size;
+    char *text = (char *)page->text.data;
+    int decoded = 0;
+    while (decoded < (int)records && (size_t)(payload_end - record) >= HISTORY_RECORD_HEADER_SIZE)
+    {
+        uint32_t expr_len = get_u32(record + 17);
+        if (expr_len > (size_t)(payload_end - record) - HISTORY_RECORD_HEADER_SIZE)
+            break;
+        Calculation *calc = &page->entries[decoded++];
+        uint64_t result_bits = get_u64(record + 8);
+        memcpy(&calc->result, &result_bits, sizeof(calc->result));
+        calc->timestamp = (time_t)(int64_t)get_u64(record);
+        calc->status = (signed char)record[16];
+        calc->expression_len = expr_len;
+        calc->expression_str = text;
+        memcpy(text, record + HISTORY_RECORD_HEADER_SIZE, expr_len);
+        text[expr_len] = '\0';
+        text += expr_len + 1;
+        record += HISTORY_RECORD_HEADER_SIZE + expr_len;
+    }
+    page->first = entry;
+    page->count = decoded;
+    page->end = offset + HISTORY_BLOCK_HEADER_SIZE + size;
+    return index - entry < decoded ? &page->entries[index - entry] : NULL;
+}
+
+static void journal_append(HistoryJournal *journal, const Calculation *calc)
+{
+    if (!encode_record(&journal->block, calc))
+        return;
+    journal->pending++;
+    if ((journal->sync_interval > 0 && journal->pending >= journal->sync_interval) ||
+        journal->block.length >= JOURNAL_BUFFER_SIZE)
+    {
+        journal_flush(journal);
+    }
+}
+
+// Copy a field slice into the history's string arena
+static char *store_field(CalculationHistory *hist, const char *field, size_t len, int quoted,
+                         unsigned int *stored_len)
+{
+    char *copy = arena_strndup(&hist->strings, field, len);
+    if (copy == NULL)
+        return NULL;
+    if (quoted)
+        len = unescape_csv_field(copy, len);
+    if (stored_len != NULL)
+        *stored_len = (unsigned int)len;
+    return copy;
+}
+
+// Move the entry array to an allocation of exactly capacity entries
+static HistoryResult resize_entries(CalculationHistory *hist, int capacity)
+{
+    Calculation *temp = safe_realloc(hist->calculations, (size_t)capacity * sizeof(Calculation));
+    if (temp == NULL)
+        return HISTORY_MEMORY_ERROR;
+    hist->calculations = temp;
+    hist->capacity = capacity;
+    if (hist->verbose >= HISTORY_VERBOSE_DETAIL)
+        printf("History capacity changed to %d entries \n", capacity);
+    return HISTORY_SUCCESS;
+}
+
+HistoryResult reserve_history(CalculationHistory *hist, int capacity)
+{
+    if (hist == NULL || capacity < 0)
+        return HISTORY_MEMORY_ERROR;
+    if (capacity <= hist->capacity)
+        return HISTORY_SUCCESS;
+    return resize_entries(hist, capacity);
+}
+
+HistoryResult shrink_history(CalculationHistory *hist)
+{
+    if (hist == NULL)
+        return HISTORY_MEMORY_ERROR;
+    int resident = hist->count - hist->first_resident;
+    if (resident == 0)
+    {
+        history_index_free(&hist->index);
+        fixed_pool_free(&hist->postings_pool);
+        hist->index_complete = 1;
+    }
+    int capacity = resident > INITIAL_HISTORY_CAPACITY ? resident : INITIAL_HISTORY_CAPACITY;
+    if (capacity >= hist->capacity)
+        return HISTORY_SUCCESS;
+    return resize_entries(hist, capacity);
+}
+
+// Drop the oldest resident entries once more than memory_limit are held.
+// They are already in the journal; flushing it makes them readable there.
+// The survivors' strings move to a fresh arena and the index is rebuilt over
+// them, so both stay in proportion to the limit. A rebuild that runs out of
+// memory leaves the index empty and incomplete until the next eviction.
+static HistoryResult evict_entries(CalculationHistory *hist)
+{
+    int resident = hist->count - hist->first_resident;
+    if (hist->memory_limit <= 0 || resident <= hist->memory_limit)
+        return HISTORY_SUCCESS;
+    HistoryJournal *journal = hist->journal;
+    if (journal == NULL || journal_flush(journal) != HISTORY_SUCCESS || !journal->indexed ||
+        journal->written != hist->count)
+    {
+        return HISTORY_FILE_ERROR; // Keep everything; the next append tries again
+    }
+
+    int evicted = resident - hist->memory_limit + hist->memory_limit / HISTORY_EVICT_DIVISOR;
+    int kept = resident - evicted;
+    Calculation *survivors = hist->calculations + evicted;
+    size_t text_size = 1;
+    for (int i = 0; i < kept; i++)
+        text_size += survivors[i].expression_len + 1;
+
+    StringArena strings;
+    arena_init(&strings, ARENA_CHUNK_SIZE);
+    char *text = arena_alloc(&strings, text_size);
+    if (text == NULL)
+        return HISTORY_MEMORY_ERROR;
+    for (int i = 0; i < kept; i++)
+    {
+        memcpy(text, survivors[i].expression_str, survivors[i].expression_len + 1);
+        survivors[i].expression_str = text;
+        text += survivors[i].expression_len + 1;
+    }
+    arena_free(&hist->strings);
+    hist->strings = strings;
+    memmove(hist->calculations, survivors, (size_t)kept * sizeof(Calculation));
+    hist->first_resident += evicted;
+
+    history_index_free(&hist->index);
+    history_index_reserve_results(&hist->index, hist->memory_limit + 1);
+    hist->index_complete = 1;
+    for (int i = 0; i < kept; i++)
+    {
+        const Calculation *calc = &hist->calculations[i];
+        if (!history_index_add(&hist->index, hist->first_resident + i, calc->expression_str,
+                               calc->expression_len, calc->status == CALC_SUCCESS, calc->result))
+        {
+            history_index_free(&hist->index);
+            hist->index_complete = 0;
+            break;
+        }
+    }
+
+    // An array that grew before the limit was set gives the rest back
+    if (hist->capacity > hist->memory_limit + 1)
+        resize_entries(hist, hist->memory_limit + 1);
+    return hist->index_complete ? HISTORY_SUCCESS : HISTORY_MEMORY_ERROR;
+}
+
+// Append an entry whose strings are given as slices; copies each string once
+static HistoryResult append_entry(CalculationHistory *hist,
+                                  const char *expr, size_t expr_len, int expr_quoted,
+                                  double result, CalcResult status, time_t timestamp)
+{
+    // Check if we need to grow the array
+    int resident = hist->count - hist->first_resident;
+    if (resident >= hist->capacity)
+    {
+        double grown = hist->capacity * (hist->growth_factor > 1.0 ? hist->growth_factor : HISTORY_GROWTH_FACTOR);
+        int new_capacity = grown < INT_MAX ? (int)grown : INT_MAX;
+        if (new_capacity <= hist->capacity)
+            new_capacity = hist->capacity + 1;
+        // Eviction never lets more than limit + 1 entries accumulate
+        if (hist->memory_limit > 0 && hist->capacity <= hist->memory_limit &&
+            new_capacity > hist->memory_limit + 1)
+        {
+            new_capacity = hist->memory_limit + 1;
+        }
+        if (resize_entries(hist, new_capacity) != HISTORY_SUCCESS)
+        {
+            fprintf(stderr, "Error : Unable to expand history \n");
+            return HISTORY_MEMORY_ERROR;
+        }
+    }
+
+    // Now we have space - add the calculation
+    Calculation *calc = &hist->calculations[resident];
+
+    // The expression lives in the arena; nothing to undo on failure
+    calc->expression_str = store_field(hist, expr, expr_len, expr_quoted, &calc->expression_len);
+    if (calc->expression_str == NULL)
+    {
+        return HISTORY_MEMORY_ERROR;
+    }
+
+    // Set other fields
+    calc->result = (status == CALC_SUCCESS) ? result : 0.0;
+    calc->timestamp = timestamp;
+    calc->status = (signed char)status;
+    if (hist->index_complete &&
+        !history_index_add(&hist->index, hist->count, calc->expression_str, calc->expression_len,
+                           status == CALC_SUCCESS, calc->result))
+    {
+        fprintf(stderr, "Error : Unable to index history entry \n");
+        return HISTORY_MEMORY_ERROR;
+    }
+    if (resident > 0 && timestamp < hist->calculations[resident - 1].timestamp)
+        hist->timestamps_sorted = 0;
+    hist->count++;
+
+    // Persist just this record when a journal is attached
+    if (hist->journal != NULL)
+    {
+        journal_append(hist->journal, calc);
+    }
+    evict_entries(hist); // On failure the entries stay resident for now
+    return HISTORY_SUCCESS;
+}
+
+const Calculation *history_entry(const CalculationHistory *hist, int index)
+{
+    if (hist == NULL || index < 0 || index >= hist->count)
+        return NULL;
+    if (index >= hist->first_resident)
+        return &hist->calculations[index - hist->first_resident];
+    if (hist->journal == NULL || !hist->journal->indexed)
+        return NULL;
+    return journal_page_in(hist->journal, index);
+}
+
 HistoryResult add_calculation(CalculationHistory *hist, const char *expr,
-                              const char *result, int is_error)
+                              double result, CalcResult status)
 {
     if (hist == NULL || expr == NULL)
         return HISTORY_MEMORY_ERROR;
 
-    // Check if we need to grow the array
-    if (hist->count >= hist->capacity)
+    uint64_t start = profile_ticks();
+    HistoryResult added = append_entry(hist, expr, strlen(expr), 0, result, status, time(NULL));
+    profile_record(PROFILE_ADD_CALCULATION, start);
+    return added;
+}
+
+// Parse an optionally signed decimal integer from [p, end)
+static const char *scan_integer(const char *p, const char *end, long long *value)
+{
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = (*p == '-');
+        p++;
+    }
+    if (p >= end || *p < '0' || *p > '9')
+        return NULL;
+
+    long long v = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        v = v * 10 + (*p - '0');
+        p++;
+    }
+    *value = negative ? -v : v;
+    return p;
+}
+
+// Locate one field starting at p. A quoted field runs to the closing quote
+// that is followed by a comma or the end of the line.
+static const char *scan_csv_field(const char *p, const char *end,
+                                  const char **field, size_t *len, int *quoted)
+{
+    if (p < end && *p == '"')
+    {
+        const char *start = p + 1;
+        const char *q = start;
+        while (q < end)
+        {
+            q = memchr(q, '"', end - q);
+            if (q == NULL)
+                break;
+            if (q + 1 == end || q[1] == ',')
+            {
+                *field = start;
+                *len = q - start;
+                *quoted = 1;
+                return q + 1;
+            }
+            q += (q[1] == '"') ? 2 : 1; // Skip "" escapes and stray quotes
+        }
+        // Unterminated quote: fall back to an unquoted field
+    }
+
+    const char *comma = memchr(p, ',', end - p);
+    const char *stop = comma != NULL ? comma : end;
+    *field = p;
+    *len = stop - p;
+    *quoted = 0;
+    return stop;
+}
+
+// Split one line (without its newline) into a CsvRecord without copying
+static HistoryResult scan_csv_record(const char *line, size_t length, CsvRecord *rec)
+{
+    const char *p = line;
+    const char *end = line + length;
+    long long value;
+
+    // Timestamp
+    p = scan_integer(p, end, &value);
+    if (p == NULL || p >= end || *p != ',')
+        return HISTORY_FILE_ERROR;
+    rec->timestamp = (time_t)value;
+    p++;
+
+    // Expression
+    p = scan_csv_field(p, end, &rec->expression, &rec->expression_len, &rec->expression_quoted);
+    if (p >= end || *p != ',')
+        return HISTORY_FILE_ERROR;
+    p++;
+
+    // Result
+    p = scan_csv_field(p, end, &rec->result, &rec->result_len, &rec->result_quoted);
+    if (p >= end || *p != ',')
+        return HISTORY_FILE_ERROR;
+    p++;
+
+    // Error flag
+    p = scan_integer(p, end, &value);
+    if (p == NULL)
+        return HISTORY_FILE_ERROR;
+    rec->is_error = (int)value;
+    return HISTORY_SUCCESS;
+}
+
+// Both names refer to the same existing file
+static int same_file(const char *a, const char *b)
+{
+    struct stat sa, sb;
+    return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+// Map a file read-only, falling back to reading it for files mmap cannot serve
+static HistoryResult open_file_view(const char *filename, FileView *view)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return HISTORY_FILE_ERROR;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return HISTORY_FILE_ERROR;
+    }
+
+    view->data = NULL;
+    view->size = 0;
+    view->mapped = 0;
+    if (S_ISREG(st.st_mode))
+    {
+        view->size = (size_t)st.st_size;
+        if (view->size == 0)
+        {
+            close(fd);
+            return HISTORY_SUCCESS;
+        }
+        void *data = mmap(NULL, view->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            madvise(data, view->size, MADV_SEQUENTIAL);
+            view->data = data;
+            view->mapped = 1;
+            close(fd);
+            return HISTORY_SUCCESS;
+        }
+    }
+
+    // Pipes and other special files: read everything into memory
+    size_t capacity = 1 << 16;
+    char *buffer = safe_malloc(capacity);
+    size_t size = 0;
+    ssize_t got;
+    while (buffer != NULL && (got = read(fd, buffer + size, capacity - size)) > 0)
+    {
+        size += (size_t)got;
+        if (size == capacity)
+        {
+            char *grown = safe_realloc(buffer, capacity * 2);
+            if (grown == NULL)
+            {
+                safe_free(buffer);
+                buffer = NULL;
+                break;
+            }
+            buffer = grown;
+            capacity *= 2;
+        }
+    }
+    close(fd);
+    if (buffer == NULL)
+        return HISTORY_MEMORY_ERROR;
+    view->data = buffer;
+    view->size = size;
+    return HISTORY_SUCCESS;
+}
+
+static void close_file_view(FileView *view)
+{
+    if (view->mapped)
+        munmap((void *)view->data, view->size);
+    else
+        safe_free((void *)view->data);
+    view->data = NULL;
+    view->size = 0;
+}
+
+// Records announced by the block headers, without touching the payloads
+static size_t count_file_records(const unsigned char *p, const unsigned char *end)
+{
+    size_t records = 0;
+    while ((size_t)(end - p) >= HISTORY_BLOCK_HEADER_SIZE &&
+           get_u32(p + 4) <= (size_t)(end - p) - HISTORY_BLOCK_HEADER_SIZE)
+    {
+        // A damaged count cannot claim more records than the payload holds
+        uint32_t most = get_u32(p + 4) / HISTORY_RECORD_HEADER_SIZE;
+        records += get_u32(p) < most ? get_u32(p) : most;
+        p += HISTORY_BLOCK_HEADER_SIZE + get_u32(p + 4);
+    }
+    return records;
+}
+
+// Size the entry array and result index for a bulk load up front. Failing
+// here is harmless: appends fall back to growing as they go.
+static void reserve_for_load(CalculationHistory *hist, size_t incoming)
+{
+    size_t total = (size_t)(hist->count - hist->first_resident) + incoming;
+    if (hist->memory_limit > 0 && total > (size_t)hist->memory_limit + 1)
+        total = (size_t)hist->memory_limit + 1;
+    if (incoming == 0 || total > INT_MAX)
+        return;
+    reserve_history(hist, (int)total);
+    history_index_reserve_results(&hist->index, (int)total);
+}
+
+static HistoryResult read_history_file(CalculationHistory *hist, const char *filename)
+{
+    if (hist == NULL || filename == NULL)
+    {
+        return HISTORY_FILE_ERROR;
+    }
+    // Its records are already in memory; loading them would journal them again
+    if (hist->journal != NULL && same_file(filename, hist->journal->path))
+    {
+        fprintf(stderr, "Error : '%s' is the history file being recorded to; it is already loaded\n",
+                filename);
+        return HISTORY_FILE_ERROR;
+    }
+    FileView view;
+    HistoryResult status = open_file_view(filename, &view);
+    if (status == HISTORY_FILE_ERROR)
+    {
+        if (hist->verbose)
+            printf("Cannot open file '%s' for reading.\n", filename);
+        return HISTORY_SUCCESS; // Not an error - file may not exist yet
+    }
+    if (status != HISTORY_SUCCESS)
+        return status;
+
+    const unsigned char *p = (const unsigned char *)view.data;
+    const unsigned char *end = p + view.size;
+    if (view.size < HISTORY_FILE_HEADER_SIZE || memcmp(p, HISTORY_FILE_MAGIC, 8) != 0 ||
+        get_u32(p + 8) != HISTORY_FILE_VERSION)
+    {
+        fprintf(stderr, "Error : '%s' is not a history file (use import for CSV)\n", filename);
+        close_file_view(&view);
+        return HISTORY_FILE_ERROR;
+    }
+    p += HISTORY_FILE_HEADER_SIZE;
+    reserve_for_load(hist, count_file_records(p, end));
+
+    // Each block is verified as a whole, then its records are copied straight
+    // out of the file image
+    int block_count = 0;
+    int loaded_count = 0;
+    while (p < end)
     {
-        int new_capacity = hist->capacity * 2; // Double the size
+        block_count++;
+        if ((size_t)(end - p) < HISTORY_BLOCK_HEADER_SIZE ||
+            get_u32(p + 4) > (size_t)(end - p) - HISTORY_BLOCK_HEADER_SIZE)
+        {
+            fprintf(stderr, "Warning : Truncated block %d in %s\n", block_count, filename);
+            status = HISTORY_FILE_ERROR;
+            break;
+        }
+        uint32_t record_count = get_u32(p);
+        uint32_t payload_size = get_u32(p + 4);
+        const unsigned char *payload = p + HISTORY_BLOCK_HEADER_SIZE;
+        if (crc32_bytes(payload, payload_size) != get_u32(p + 8))
+        {
+            fprintf(stderr, "Warning : Checksum mismatch in block %d of %s\n", block_count, filename);
+            status = HISTORY_FILE_ERROR;
+            break;
+        }
+
+        const unsigned char *record = payload;
+        const unsigned char *payload_end = payload + payload_size;
+        for (uint32_t i = 0; i < record_count; i++)
+        {
+            if ((size_t)(payload_end - record) < HISTORY_RECORD_HEADER_SIZE)
+                break;
+            uint32_t expr_len = get_u32(record + 17);
+            if (expr_len > (size_t)(payload_end - record) - HISTORY_RECORD_HEADER_SIZE)
+                break;
+
+            uint64_t result_bits = get_u64(record + 8);
+            double result;
+            memcpy(&result, &result_bits, sizeof(result));
+            if (append_entry(hist, (const char *)record + HISTORY_RECORD_HEADER_SIZE, expr_len, 0,
+                             result, (CalcResult)(signed char)record[16],
+                             (time_t)(int64_t)get_u64(record)) == HISTORY_SUCCESS)
+            {
+                loaded_count++;
+            }
+            record += HISTORY_RECORD_HEADER_SIZE + expr_len;
+        }
+        p = payload_end;
+    }
+    close_file_view(&view);
+    if (hist->verbose)
+        printf("Loaded %d calculations from %s\n", loaded_count, filename);
+    return status;
+}
+
+HistoryResult load_history_from_file(CalculationHistory *hist, const char *filename)
+{
+    uint64_t start = profile_ticks();
+    HistoryResult status = read_history_file(hist, filename);
+    profile_record(PROFILE_LOAD_HISTORY, start);
+    return status;
+}
+
+HistoryResult import_history_csv(CalculationHistory *hist, const char *filename)
+{
+    if (hist == NULL || filename == NULL)
+    {
+        return HISTORY_FILE_ERROR;
+    }
+    FileView view;
+    HistoryResult status = open_file_view(filename, &view);
+    if (status != HISTORY_SUCCESS)
+    {
+        fprintf(stderr, "Error : Cannot open file '%s' for reading\n", filename);
+        return status;
+    }
+
+    // Skip header line
+    const char *p = view.data;
+    const char *end = view.data + view.size;
+    const char *newline = (p != NULL) ? memchr(p, '\n', end - p) : NULL;
+    if (newline == NULL)
+    {
+        close_file_view(&view);
+        return HISTORY_FILE_ERROR;
+    }
+    p = newline + 1;
+
+    // One entry per line at most; counting newlines is cheap next to parsing
+    size_t lines = 0;
+    for (const char *q = p; q < end && (q = memchr(q, '\n', end - q)) != NULL; q++)
+        lines++;
+    reserve_for_load(hist, lines + 1);
+
+    // Scan each data line directly in the file image
+    int line_count = 0;
+    int loaded_count = 0;
+    while (p < end)
+    {
+        newline = memchr(p, '\n', end - p);
+        const char *line_end = (newline != NULL) ? newline : end;
+        size_t length = line_end - p;
+        if (length > 0 && p[length - 1] == '\r')
+            length--;
+        line_count++;
+
+        if (length > 0)
+        {
+            CsvRecord rec;
+            if (scan_csv_record(p, length, &rec) == HISTORY_SUCCESS)
+            {
+                double value;
+                CalcResult status;
+                decode_csv_result(&rec, &value, &status);
+                if (append_entry(hist, rec.expression, rec.expression_len, rec.expression_quoted,
+                                 value, status, rec.timestamp) == HISTORY_SUCCESS)
+                {
+                    loaded_count++;
+                }
+            }
+            else
+            {
+                fprintf(stderr, "Warning : Could not parse line %d in %s\n",
+                        line_count, filename);
+            }
+        }
+        p = line_end + 1;
+    }
+    close_file_view(&view);
+    if (hist->verbose)
+        printf("Imported %d calculations from %s\n", loaded_count, filename);
+    return HISTORY_SUCCESS;
+}
+
+// Append one entry as "[N] expression = result (time)"; the expression goes
+// through unformatted so long ones are never truncated
+void write_calculation(OutputBuffer *out, TimestampCache *times, const Calculation *calc,
+                       int number)
+{
+    char time_str[TIMESTAMP_STRING_SIZE];
+    char text[DOUBLE_STRING_SIZE];
+    format_timestamp_cached(times, calc->timestamp, time_str, sizeof(time_str));
+    output_buffer_printf(out, "[%d] ", number);
+    output_buffer_write(out, calc->expression_str, calc->expression_len);
+    output_buffer_printf(out, " = %s%s (%s)\n", calc->status != CALC_SUCCESS ? "ERROR: " : "",
+                         result_text(calc, text, sizeof(text)), time_str);
+}
+
+static void write_entry(OutputBuffer *out, TimestampCache *times,
+                        const CalculationHistory *hist, int index)
+{
+    const Calculation *calc = history_entry(hist, index);
+    if (calc != NULL)
+        write_calculation(out, times, calc, index + 1);
+    else
+        output_buffer_printf(out, "[%d] (unreadable)\n", index + 1);
+}
+
+static int open_display(OutputBuffer *out, TimestampCache *times)
+{
+    timestamp_cache_init(times);
+    fflush(stdout); // Keep earlier printf output ahead of ours
+    return output_buffer_init(out, stdout, DISPLAY_BUFFER_SIZE);
+}
 
-        // Attempt to reallocate memory
-        Calculation *temp = realloc(hist->calculations,
-                                    new_capacity * sizeof(Calculation));
-        if (temp == NULL)
-        {
-            fprintf(stderr, "Error : Unable to expand history \n");
-            return HISTORY_MEMORY_ERROR;
-        }
+static void close_display(OutputBuffer *out)
+{
+    output_buffer_flush(out);
+    output_buffer_free(out);
+}
 
-        // Success - update our structure
-        hist->calculations = temp;
-        hist->capacity = new_capacity;
-        printf("History capacity expanded to %d entries \n", new_capacity);
+void display_history(const CalculationHistory *hist)
+{
+    printf("Calculation History (%d entries):\n", hist->count);
+    if (hist->count == 0)
+    {
+        printf("History is empty.\n");
+        return;
     }
+    display_history_range(hist, 0, hist->count);
+}
 
-    // Now we have space - add the calculation
-    Calculation *calc = &hist->calculations[hist->count];
+void display_history_range(const CalculationHistory *hist, int first, int count)
+{
+    if (first < 0)
+        first = 0;
+    if (count > hist->count - first)
+        count = hist->count - first;
 
-    // Allocate memory for expression string
-    calc->expression_str = malloc(strlen(expr) + 1);
-    if (calc->expression_str == NULL)
+    OutputBuffer out;
+    TimestampCache times;
+    if (count <= 0 || !open_display(&out, &times))
+        return;
+    for (int i = first; i < first + count; i++)
     {
-        return HISTORY_MEMORY_ERROR;
+        write_entry(&out, &times, hist, i);
     }
-    strcpy(calc->expression_str, expr);
+    close_display(&out);
+}
 
-    // Allocate memory for result string
-    calc->result = malloc(strlen(result) + 1);
-    if (calc->result == NULL)
+// First entry whose timestamp is at or after (inclusive) or strictly after
+// (!inclusive) the given time; needs timestamps in order. Probes of evicted
+// entries page their blocks in.
+static int time_bound(const CalculationHistory *hist, time_t timestamp, int inclusive)
+{
+    int lo = 0, hi = hist->count;
+    while (lo < hi)
     {
-        free(calc->expression_str); // free previously allocated memory
-        return HISTORY_MEMORY_ERROR;
+        int mid = lo + (hi - lo) / 2;
+        const Calculation *calc = history_entry(hist, mid);
+        time_t t = calc != NULL ? calc->timestamp : timestamp;
+        if (inclusive ? t < timestamp : t <= timestamp)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    strcpy(calc->result, result);
-
-    // Set other fields
-    calc->timestamp = time(NULL);
-    calc->is_error = is_error;
-    hist->count++;
-    return HISTORY_SUCCESS;
+    return lo;
 }
 
-HistoryResult load_history_from_file(CalculationHistory *hist,
-                                     const char *filename)
+int display_history_window(const CalculationHistory *hist, time_t since, time_t until)
 {
-    if (hist == NULL || filename == NULL)
+    if (hist->timestamps_sorted)
     {
-        return HISTORY_FILE_ERROR;
+        int first = time_bound(hist, since, 1);
+        int end = time_bound(hist, until, 0);
+        display_history_range(hist, first, end - first);
+        return end > first ? end - first : 0;
     }
-    FILE *file = fopen(filename, "r");
-    if (file == NULL)
+
+    // Out-of-order timestamps (e.g. an imported file): scan everything
+    OutputBuffer out;
+    TimestampCache times;
+    if (!open_display(&out, &times))
+        return 0;
+    int shown = 0;
+    for (int i = 0; i < hist->count; i++)
     {
-        printf("Cannot open file '%s' for reading.\n", filename);
-        return HISTORY_SUCCESS; // Not an error - file may not exist yet
+        const Calculation *calc = history_entry(hist, i);
+        if (calc != NULL && calc->timestamp >= since && calc->timestamp <= until)
+        {
+            write_entry(&out, &times, hist, i);
+            shown++;
+        }
     }
-    char line[512]; // Buffer for reading lines
-    int line_count = 0;
-    int loaded_count = 0;
-    // Skip header line
-    if (fgets(line, sizeof(line), file) == NULL)
+    close_display(&out);
+    return shown;
+}
+
+void display_history_entry(const CalculationHistory *hist, int index)
+{
+    // Simulate replaying the calculation
+    printf("Replaying calculation [%d]:\n", index + 1);
+    display_history_range(hist, index, 1);
+}
+
+void display_history_matches(const CalculationHistory *hist, const HistoryMatches *matches,
+                             int limit)
+{
+    printf("Found %d matching entries\n", matches->count);
+    OutputBuffer out;
+    TimestampCache times;
+    if (open_display(&out, &times))
     {
-        fclose(file);
-        return HISTORY_FILE_ERROR;
+        for (int i = 0; i < matches->count && i < limit; i++)
+        {
+            write_entry(&out, &times, hist, matches->entries[i]);
+        }
+        close_display(&out);
     }
-    // Read each data line
-    while (fgets(line, sizeof(line), file) != NULL)
+    if (matches->count > limit)
+        printf("... %d more not shown\n", matches->count - limit);
+}
+
+HistoryResult search_history(const CalculationHistory *hist, const char *pattern,
+                             HistoryMatches *matches)
+{
+    if (hist == NULL || pattern == NULL || matches == NULL)
+        return HISTORY_MEMORY_ERROR;
+
+    size_t length = strlen(pattern);
+    HistoryMatches candidates;
+    history_matches_init(&candidates);
+    if (hist->index_complete && history_index_candidates(&hist->index, pattern, length, &candidates))
     {
-        line_count++;
-        // Remove newline character
-        line[strcspn(line, "\n")] = '\0';
-        if (strlen(line) == 0)
-            continue; // Skip empty lines
-        // Parse this line into a temporary Calculation
-        Calculation temp_calc;
-        if (parse_csv_line(line, &temp_calc) == HISTORY_SUCCESS)
+        // Every trigram matched; confirm the whole pattern
+        for (int i = 0; i < candidates.count; i++)
         {
-            // Add to history (this handles memory allocation )
-            if (add_calculation(hist, temp_calc.expression_str,
-                                temp_calc.result, temp_calc.is_error) == HISTORY_SUCCESS)
+            int entry = candidates.entries[i];
+            if (strstr(hist->calculations[entry - hist->first_resident].expression_str, pattern) != NULL &&
+                !history_matches_add(matches, entry))
             {
-                // Update timestamp ( add_calculation sets current time)
-                hist->calculations[hist->count - 1].timestamp = temp_calc.timestamp;
-                loaded_count++;
+                history_matches_free(&candidates);
+                return HISTORY_MEMORY_ERROR;
             }
-            // Free temporary string
-            free(temp_calc.expression_str);
-            free(temp_calc.result);
         }
-        else
+        history_matches_free(&candidates);
+        return HISTORY_SUCCESS;
+    }
+
+    // Patterns shorter than a trigram, or an incomplete index, fall back to a scan
+    for (int i = 0; i < hist->count - hist->first_resident; i++)
+    {
+        if (strstr(hist->calculations[i].expression_str, pattern) != NULL &&
+            !history_matches_add(matches, hist->first_resident + i))
         {
-            fprintf(stderr, "Warning : Could not parse line %d in %s\n",
-                    line_count, filename);
+            return HISTORY_MEMORY_ERROR;
         }
     }
-    fclose(file);
-    printf("Loaded %d calculations from %s\n", loaded_count,
-           filename);
     return HISTORY_SUCCESS;
 }
 
-void display_history(const CalculationHistory *hist)
+static int compare_result_keys(const void *a, const void *b)
 {
-    printf("Calculation History (%d entries):\n", hist->count);
-    if (hist->count == 0)
-    {
-        printf("History is empty.\n");
-        return;
-    }
-    for (int i = 0; i < hist->count; i++)
+    const ResultKey *x = a;
+    const ResultKey *y = b;
+    if (x->value != y->value)
+        return x->value < y->value ? -1 : 1;
+    return x->entry - y->entry;
+}
+
+// What history_index_results returns, found by scanning the resident entries
+static HistoryResult scan_results(const CalculationHistory *hist, double low, int low_inclusive,
+                                  double high, int high_inclusive, HistoryMatches *matches)
+{
+    int resident = hist->count - hist->first_resident;
+    ResultKey *keys = resident > 0 ? safe_malloc(resident * sizeof(ResultKey)) : NULL;
+    if (resident > 0 && keys == NULL)
+        return HISTORY_MEMORY_ERROR;
+    int key_count = 0;
+    for (int i = 0; i < resident; i++)
     {
         const Calculation *calc = &hist->calculations[i];
-        char time_str[20];
-        format_timestamp(calc->timestamp, time_str, sizeof(time_str));
-        if (calc->is_error)
-        {
-            printf("[%d] %s = ERROR: %s (%s)\n", i + 1,
-                   calc->expression_str, calc->result, time_str);
-        }
-        else
+        double v = calc->result;
+        if (calc->status == CALC_SUCCESS && (low_inclusive ? v >= low : v > low) &&
+            (high_inclusive ? v <= high : v < high))
         {
-            printf("[%d] %s = %s (%s)\n", i + 1, calc->expression_str, calc->result, time_str);
+            keys[key_count].value = v;
+            keys[key_count].entry = hist->first_resident + i;
+            key_count++;
         }
     }
+    if (key_count > 1)
+        qsort(keys, key_count, sizeof(ResultKey), compare_result_keys);
+
+    HistoryResult status = HISTORY_SUCCESS;
+    for (int i = 0; i < key_count && status == HISTORY_SUCCESS; i++)
+    {
+        if (!history_matches_add(matches, keys[i].entry))
+            status = HISTORY_MEMORY_ERROR;
+    }
+    safe_free(keys);
+    return status;
 }
 
-void display_history_entry(const CalculationHistory *hist, int index)
+HistoryResult find_history_by_result(CalculationHistory *hist, const char *op, double value,
+                                     HistoryMatches *matches)
 {
-    const Calculation *calc = &hist->calculations[index];
-    // Simulate replaying the calculation
-    printf("Replaying calculation [%d]:\n", index + 1);
-    char time_str[20];
-    format_timestamp(calc->timestamp, time_str, sizeof(time_str));
-    if (calc->is_error)
+    if (hist == NULL || op == NULL || matches == NULL)
+        return HISTORY_MEMORY_ERROR;
+
+    double low = -INFINITY, high = INFINITY;
+    int low_inclusive = 1, high_inclusive = 1;
+    if (strcmp(op, ">") == 0)
     {
-        printf("[%d] %s = ERROR: %s (%s)\n", index + 1,
-               calc->expression_str, calc->result, time_str);
+        low = value;
+        low_inclusive = 0;
     }
-    else
+    else if (strcmp(op, ">=") == 0)
+        low = value;
+    else if (strcmp(op, "<") == 0)
     {
-        printf("[%d] %s = %s (%s)\n", index + 1, calc->expression_str, calc->result, time_str);
+        high = value;
+        high_inclusive = 0;
     }
+    else if (strcmp(op, "<=") == 0)
+        high = value;
+    else if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+        low = high = value;
+    else
+        return HISTORY_INVALID_INDEX;
+
+    if (!hist->index_complete)
+        return scan_results(hist, low, low_inclusive, high, high_inclusive, matches);
+    if (!history_index_results(&hist->index, low, low_inclusive, high, high_inclusive, matches))
+        return HISTORY_MEMORY_ERROR;
+    return HISTORY_SUCCESS;
+}
+
+// Free the entry array and all strings at once
+static void free_entries(CalculationHistory *hist)
+{
+    arena_free(&hist->strings);
+    history_index_free(&hist->index);
+    fixed_pool_free(&hist->postings_pool);
+    safe_free(hist->calculations);
+    hist->calculations = NULL;
+    hist->count = 0;
+    hist->first_resident = 0;
+    hist->capacity = 0;
 }
 
 HistoryResult clear_history(CalculationHistory *hist)
 {
     if (hist == NULL)
         return HISTORY_MEMORY_ERROR;
-    cleanup_history(hist);
+    arena_reset(&hist->strings); // Keep one chunk for the next entries
     hist->count = 0;
-    hist->capacity = INITIAL_HISTORY_CAPACITY;
-    hist->calculations = malloc(hist->capacity * sizeof(Calculation));
+    hist->first_resident = 0;
+    hist->timestamps_sorted = 1;
+    if (shrink_history(hist) != HISTORY_SUCCESS)
+        return HISTORY_MEMORY_ERROR;
+
+    // The journal still holds the cleared entries; compact it
+    if (hist->journal != NULL)
+        return compact_history_journal(hist);
+    return HISTORY_SUCCESS;
+}
+
+// Evaluate one stored expression again
+static void replay_entry(const Calculation *calc, double *result, signed char *status)
+{
+    double value = 0.0;
+    CalcResult calc_status = parse_expression(calc->expression_str, &value, NULL);
+    *result = calc_status == CALC_SUCCESS ? value : 0.0;
+    *status = (signed char)calc_status;
+}
+
+// A replayed entry diverges when its status changes or a successful result
+// differs (NaN matches NaN)
+static int replay_diverges(const Calculation *calc, double result, signed char status)
+{
+    if (status != calc->status)
+        return 1;
+    if (status != CALC_SUCCESS)
+        return 0;
+    return result != calc->result && !(result != result && calc->result != calc->result);
+}
+
+HistoryResult replay_calculation(const CalculationHistory *hist, int index, double *result,
+                                 CalcResult *status)
+{
+    if (hist == NULL || index < 0 || index >= hist->count || result == NULL || status == NULL)
+        return HISTORY_MEMORY_ERROR;
+
+    const Calculation *calc = history_entry(hist, index);
+    if (calc == NULL)
+        return HISTORY_FILE_ERROR;
+    signed char replayed;
+    replay_entry(calc, result, &replayed);
+    *status = (CalcResult)replayed;
     return HISTORY_SUCCESS;
 }
 
-HistoryResult replay_calculation(const CalculationHistory *hist, int index, char *result)
+typedef struct
+{
+    const CalculationHistory *hist;
+    ReplayReport *report;
+    int first; // First resident entry of the report's range
+} ReplayJob;
+
+// One task re-evaluates REPLAY_TASK_ENTRIES consecutive resident entries
+static void replay_task(void *context, size_t task, int worker)
+{
+    (void)worker;
+    ReplayJob *job = context;
+    ReplayReport *report = job->report;
+    int end_entry = report->first + report->count;
+    int begin = job->first + (int)task * REPLAY_TASK_ENTRIES;
+    int end = end_entry - begin > REPLAY_TASK_ENTRIES ? begin + REPLAY_TASK_ENTRIES : end_entry;
+    for (int i = begin; i < end; i++)
+    {
+        replay_entry(&job->hist->calculations[i - job->hist->first_resident],
+                     &report->results[i - report->first], &report->statuses[i - report->first]);
+    }
+}
+
+HistoryResult replay_history(const CalculationHistory *hist, int first, int count, int threads,
+                             ReplayReport *report)
 {
-    if (hist == NULL || index < 0 || index >= hist->count || result == NULL)
+    if (hist == NULL || report == NULL)
+        return HISTORY_MEMORY_ERROR;
+    if (first < 0 || count < 0 || first + count > hist->count)
+        return HISTORY_INVALID_INDEX;
+
+    report->first = first;
+    report->count = count;
+    history_matches_init(&report->diverged);
+    report->results = safe_malloc((count > 0 ? count : 1) * sizeof(double));
+    report->statuses = safe_malloc(count > 0 ? count : 1);
+    if (report->results == NULL || report->statuses == NULL)
+    {
+        free_replay_report(report);
+        return HISTORY_MEMORY_ERROR;
+    }
+
+    // Evicted entries are paged in block by block on this thread; the
+    // resident rest is spread over the pool
+    int resident = first > hist->first_resident ? first : hist->first_resident;
+    if (resident > first + count)
+        resident = first + count;
+    for (int i = first; i < resident; i++)
+    {
+        const Calculation *calc = history_entry(hist, i);
+        if (calc == NULL)
+        {
+            free_replay_report(report);
+            return HISTORY_FILE_ERROR;
+        }
+        replay_entry(calc, &report->results[i - first], &report->statuses[i - first]);
+    }
+
+    // Small ranges are not worth starting threads for
+    size_t tasks = ((size_t)(first + count - resident) + REPLAY_TASK_ENTRIES - 1) / REPLAY_TASK_ENTRIES;
+    if ((size_t)threads > tasks)
+        threads = (int)tasks;
+    ThreadPool *pool = thread_pool_create(threads);
+    if (pool == NULL)
+    {
+        free_replay_report(report);
         return HISTORY_MEMORY_ERROR;
+    }
+    ReplayJob job = {hist, report, resident};
+    thread_pool_run(pool, tasks, replay_task, &job);
+    thread_pool_destroy(pool);
 
-    const Calculation *calc = &hist->calculations[index];
-    strcpy(result, calc->result);
+    for (int i = 0; i < count; i++)
+    {
+        const Calculation *calc = history_entry(hist, first + i);
+        if (calc != NULL && replay_diverges(calc, report->results[i], report->statuses[i]) &&
+            !history_matches_add(&report->diverged, first + i))
+        {
+            free_replay_report(report);
+            return HISTORY_MEMORY_ERROR;
+        }
+    }
     return HISTORY_SUCCESS;
 }
 
+void free_replay_report(ReplayReport *report)
+{
+    if (report == NULL)
+        return;
+    safe_free(report->results);
+    safe_free(report->statuses);
+    history_matches_free(&report->diverged);
+    report->results = NULL;
+    report->statuses = NULL;
+    report->count = 0;
+}
+
 void cleanup_history(CalculationHistory *hist)
 {
     if (hist == NULL)
         return;
-    if (hist->calculations != NULL)
+    detach_history_journal(hist);
+    free_entries(hist);
+}
+
+static HistoryResult write_history_file(const CalculationHistory *hist, const char *filename)
+{
+    if (hist == NULL || filename == NULL)
+        return HISTORY_FILE_ERROR;
+    // Records still pending in the journal must not land after the rewrite
+    if (hist->journal != NULL)
+    {
+        HistoryResult flushed = journal_flush(hist->journal);
+        // With a directory the journal file already holds every entry; it is
+        // also where evicted entries are read from, so it is not rewritten
+        if (hist->journal->indexed && same_file(filename, hist->journal->path))
+            return flushed;
+    }
+
+    FILE *file = fopen(filename, "wb"); // Open file for writing
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error : Cannot open file '%s' for writing \n",
+                filename);
+        return HISTORY_FILE_ERROR;
+    }
+
+    ByteBuffer block;
+    byte_buffer_init(&block);
+    int ok = write_file_header(file);
+    int in_block = 0;
+    for (int i = 0; ok && i < hist->count; i++)
     {
-        // Free each expression string first
-        for (int i = 0; i < hist->count; i++)
+        const Calculation *calc = history_entry(hist, i);
+        ok = calc != NULL && encode_record(&block, calc);
+        in_block++;
+        if (ok && in_block == HISTORY_BLOCK_RECORDS)
         {
-            if (hist->calculations[i].expression_str != NULL)
-            {
-                free(hist->calculations[i].expression_str);
-                hist->calculations[i].expression_str = NULL;
-            }
-            if (hist->calculations[i].result)
-            {
-                free(hist->calculations[i].result);
-                hist->calculations[i].result = NULL;
-            }
+            ok = write_block(file, &block, in_block);
+            block.length = 0;
+            in_block = 0;
         }
-        // Free the array itself
-        free(hist->calculations);
-        hist->calculations = NULL;
     }
-    // Reset structure
-    hist->count = 0;
-    hist->capacity = 0;
+    if (ok && in_block > 0)
+        ok = write_block(file, &block, in_block);
+    byte_buffer_free(&block);
+
+    if (fclose(file) != 0 || !ok)
+        return HISTORY_FILE_ERROR;
+    return HISTORY_SUCCESS;
+}
+
+HistoryResult save_history_to_file(const CalculationHistory *hist, const char *filename)
+{
+    uint64_t start = profile_ticks();
+    HistoryResult status = write_history_file(hist, filename);
+    profile_record(PROFILE_SAVE_HISTORY, start);
+    return status;
 }
 
-HistoryResult save_history_to_file(const CalculationHistory *hist,
-                                   const char *filename)
+HistoryResult export_history_csv(const CalculationHistory *hist, const char *filename)
 {
     if (hist == NULL || filename == NULL)
         return HISTORY_FILE_ERROR;
-    FILE *file = fopen(filename, "w"); // Open file for writing
+    FILE *file = fopen(filename, "w");
     if (file == NULL)
     {
         fprintf(stderr, "Error : Cannot open file '%s' for writing \n",
@@ -239,115 +1548,284 @@ HistoryResult save_history_to_file(const CalculationHistory *hist,
         return HISTORY_FILE_ERROR;
     }
     // Write CSV header
-    fprintf(file, "Timestamp ,Expression ,Result ,Error \n");
-    for (int i = 0; i < hist->count; i++)
+    fprintf(file, HISTORY_CSV_HEADER);
+    int ok = 1;
+    for (int i = 0; ok && i < hist->count; i++)
     {
-        const Calculation *calc = &hist->calculations[i];
-        // Write in CSV format
-        fprintf(file, "%ld,\"%s\",\"%s\",%d\n",
-                (long)calc->timestamp,
-                calc->expression_str,
-                calc->result,
-                calc->is_error);
+        const Calculation *calc = history_entry(hist, i);
+        ok = calc != NULL;
+        if (ok)
+            write_csv_record(file, calc);
     }
-    fclose(file);
+    if (fclose(file) != 0 || !ok)
+        return HISTORY_FILE_ERROR;
     return HISTORY_SUCCESS;
 }
 
-HistoryResult parse_csv_line(const char *line, Calculation *calc)
+// Check that an existing, non-empty file starts with the binary header
+static int has_history_header(const char *filename)
 {
-    if (line == NULL || calc == NULL)
-        return HISTORY_MEMORY_ERROR;
-    // Create a working copy of the line ( strtok modifies the string)
-    char *line_copy = malloc(strlen(line) + 1);
-    if (line_copy == NULL)
-        return HISTORY_MEMORY_ERROR;
-    strcpy(line_copy, line);
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+        return 1; // Will be created
+    unsigned char header[HISTORY_FILE_HEADER_SIZE];
+    size_t got = fread(header, 1, sizeof(header), file);
+    fclose(file);
+    if (got == 0)
+        return 1; // Empty file, header will be written
+    return got == sizeof(header) && memcmp(header, HISTORY_FILE_MAGIC, 8) == 0;
+}
 
-    // Parse timestamp
-    char *token = strtok(line_copy, ",");
-    if (token == NULL)
+// Cut a history file back to its header and the intact blocks before the
+// first torn or damaged one. The loader stops at that block, so anything
+// appended after it would never be read again.
+static HistoryResult drop_damaged_tail(const char *filename)
+{
+    FileView view;
+    if (open_file_view(filename, &view) != HISTORY_SUCCESS)
+        return HISTORY_SUCCESS; // Nothing to repair; opening will report real problems
+    if (view.size <= HISTORY_FILE_HEADER_SIZE)
     {
-        free(line_copy);
-        return HISTORY_FILE_ERROR;
+        close_file_view(&view);
+        return HISTORY_SUCCESS;
     }
-    calc->timestamp = (time_t)atol(token);
 
-    // Parse expression ( remove quotes )
-    token = strtok(NULL, ",");
-    if (token == NULL)
+    const unsigned char *start = (const unsigned char *)view.data;
+    const unsigned char *p = start + HISTORY_FILE_HEADER_SIZE;
+    const unsigned char *end = start + view.size;
+    while ((size_t)(end - p) >= HISTORY_BLOCK_HEADER_SIZE &&
+           get_u32(p + 4) <= (size_t)(end - p) - HISTORY_BLOCK_HEADER_SIZE &&
+           crc32_bytes(p + HISTORY_BLOCK_HEADER_SIZE, get_u32(p + 4)) == get_u32(p + 8))
     {
-        free(line_copy);
-        return HISTORY_FILE_ERROR;
+        p += HISTORY_BLOCK_HEADER_SIZE + get_u32(p + 4);
     }
+    size_t intact = (size_t)(p - start);
+    size_t size = view.size;
+    close_file_view(&view);
+    if (intact == size)
+        return HISTORY_SUCCESS;
+
+    fprintf(stderr, "Warning : Dropping %zu damaged bytes at the end of %s\n", size - intact, filename);
+    return truncate(filename, (off_t)intact) == 0 ? HISTORY_SUCCESS : HISTORY_FILE_ERROR;
+}
+
+HistoryResult attach_history_journal(CalculationHistory *hist, const char *filename,
+                                     int sync_interval)
+{
+    if (hist == NULL || filename == NULL)
+        return HISTORY_FILE_ERROR;
+    detach_history_journal(hist);
 
-    // Remove quotes from expression
-    if (token[0] == '"')
+    if (!has_history_header(filename))
     {
-        token++; // Skip opening quote
-        int len = strlen(token);
-        if (len > 0 && token[len - 1] == '"')
-        {
-            token[len - 1] = '\0'; // Remove closing quote
-        }
+        fprintf(stderr, "Error : '%s' is not a history file; not appending to it\n", filename);
+        return HISTORY_FILE_ERROR;
+    }
+    if (drop_damaged_tail(filename) != HISTORY_SUCCESS)
+    {
+        fprintf(stderr, "Error : Cannot repair '%s'; not appending to it\n", filename);
+        return HISTORY_FILE_ERROR;
     }
 
-    // Allocate memory for expression
-    calc->expression_str = malloc(strlen(token) + 1);
-    if (calc->expression_str == NULL)
+    HistoryJournal *journal = safe_calloc(1, sizeof(HistoryJournal));
+    if (journal == NULL)
+        return HISTORY_MEMORY_ERROR;
+    journal->path = safe_malloc(strlen(filename) + 1);
+    if (journal->path == NULL)
     {
-        free(line_copy);
+        safe_free(journal);
         return HISTORY_MEMORY_ERROR;
     }
-    strcpy(calc->expression_str, token);
+    strcpy(journal->path, filename);
+    journal->fd = -1;
 
-    // Parse result
-    token = strtok(NULL, ",");
-    if (token == NULL)
+    journal->file = fopen(filename, "ab");
+    if (journal->file == NULL)
     {
-        free(line_copy);
+        fprintf(stderr, "Error : Cannot open file '%s' for appending \n", filename);
+        safe_free(journal->path);
+        safe_free(journal);
         return HISTORY_FILE_ERROR;
     }
+    journal->sync_interval = sync_interval;
 
-    // Remove quotes from expression
-    if (token[0] == '"')
+    // A brand new file needs its header
+    fseek(journal->file, 0, SEEK_END);
+    if (ftell(journal->file) == 0)
     {
-        token++; // Skip opening quote
-        int len = strlen(token);
-        if (len > 0 && token[len - 1] == '"')
-        {
-            token[len - 1] = '\0'; // Remove closing quote
-        }
+        write_file_header(journal->file);
+        journal_flush(journal);
+    }
+    hist->journal = journal;
+    return HISTORY_SUCCESS;
+}
+
+HistoryResult flush_history_journal(CalculationHistory *hist)
+{
+    if (hist == NULL || hist->journal == NULL)
+        return HISTORY_SUCCESS;
+    return journal_flush(hist->journal);
+}
+
+// Rewrite the journal file from the in-memory entries, then keep appending to it
+HistoryResult compact_history_journal(CalculationHistory *hist)
+{
+    if (hist == NULL || hist->journal == NULL)
+        return HISTORY_FILE_ERROR;
+
+    // Evicted entries only live in the file, which holds nothing else
+    HistoryJournal *journal = hist->journal;
+    if (hist->first_resident > 0)
+        return journal_flush(journal);
+
+    int indexed = journal->indexed;
+    drop_directory(journal);
+    HistoryResult status = save_history_to_file(hist, journal->path);
+    if (status != HISTORY_SUCCESS)
+        return status;
+
+    FILE *reopened = freopen(journal->path, "ab", journal->file);
+    if (reopened == NULL)
+    {
+        journal->file = NULL;
+        detach_history_journal(hist);
+        return HISTORY_FILE_ERROR;
     }
+    journal->file = reopened;
+    if (indexed && !build_directory(journal, hist->count))
+        return HISTORY_FILE_ERROR;
+    return HISTORY_SUCCESS;
+}
 
-    // Allocate memory for result
-    calc->result = malloc(strlen(token) + 1);
-    if (calc->result == NULL)
+void detach_history_journal(CalculationHistory *hist)
+{
+    if (hist == NULL || hist->journal == NULL)
+        return;
+
+    HistoryJournal *journal = hist->journal;
+    if (journal->file != NULL)
     {
-        free(calc->expression_str);
-        free(line_copy);
-        return HISTORY_MEMORY_ERROR;
+        journal_flush(journal);
+        fclose(journal->file);
     }
-    strcpy(calc->result, token);
+    if (journal->fd >= 0)
+        close(journal->fd);
+    byte_buffer_free(&journal->block);
+    safe_free(journal->checkpoints);
+    safe_free(journal->page.entries);
+    byte_buffer_free(&journal->page.payload);
+    byte_buffer_free(&journal->page.text);
+    safe_free(journal->path);
+    safe_free(journal);
+    hist->journal = NULL;
+}
 
-    // Parse error flag
-    token = strtok(NULL, ",");
-    if (token == NULL)
+HistoryResult set_history_memory_limit(CalculationHistory *hist, int limit)
+{
+    if (hist == NULL)
+        return HISTORY_MEMORY_ERROR;
+    if (limit < 0 || limit == INT_MAX)
+        return HISTORY_INVALID_INDEX;
+    if (limit > 0 && hist->journal == NULL)
     {
-        free(calc->expression_str);
-        free(line_copy);
+        fprintf(stderr, "Error : A history memory limit needs a history file to evict to\n");
         return HISTORY_FILE_ERROR;
     }
-    calc->is_error = atoi(token);
 
-    free(line_copy);
+    HistoryJournal *journal = hist->journal;
+    if (limit > 0 && !journal->indexed)
+    {
+        HistoryResult status = journal_flush(journal);
+        if (status != HISTORY_SUCCESS)
+            return status;
+        if (!build_directory(journal, hist->count))
+        {
+            // The file does not hold exactly the entries (e.g. it was attached
+            // after loading another file); rewrite it from memory first
+            if (hist->first_resident > 0)
+                return HISTORY_FILE_ERROR;
+            status = compact_history_journal(hist);
+            if (status != HISTORY_SUCCESS)
+                return status;
+            if (!build_directory(journal, hist->count))
+                return HISTORY_FILE_ERROR;
+        }
+    }
+    hist->memory_limit = limit;
+    return evict_entries(hist);
+}
+
+HistoryResult parse_csv_line(const char *line, Calculation *calc)
+{
+    if (line == NULL || calc == NULL)
+        return HISTORY_MEMORY_ERROR;
+
+    CsvRecord rec;
+    HistoryResult status = scan_csv_record(line, strcspn(line, "\r\n"), &rec);
+    if (status != HISTORY_SUCCESS)
+        return status;
+
+    // Allocate memory for expression
+    calc->expression_str = copy_field(rec.expression, rec.expression_len, rec.expression_quoted);
+    if (calc->expression_str == NULL)
+        return HISTORY_MEMORY_ERROR;
+
+    CalcResult calc_status;
+    decode_csv_result(&rec, &calc->result, &calc_status);
+    calc->status = (signed char)calc_status;
+    calc->expression_len = (unsigned int)strlen(calc->expression_str);
+    calc->timestamp = rec.timestamp;
     return HISTORY_SUCCESS;
 }
 
 void format_timestamp(time_t timestamp, char *buffer, size_t buffer_size)
 {
-    struct tm *tm_info = localtime(&timestamp);
-    strftime(buffer, buffer_size, "%Y-%m-%d %H:%M:%S", tm_info);
+    struct tm tm_info;
+    localtime_r(&timestamp, &tm_info);
+    strftime(buffer, buffer_size, "%Y-%m-%d %H:%M:%S", &tm_info);
+}
+
+void timestamp_cache_init(TimestampCache *cache)
+{
+    cache->day_start = 0;
+    cache->day_end = 0; // Empty range: the first call fills it
+    cache->date[0] = '\0';
+}
+
+// Same output as format_timestamp. The date part is cached for the local day
+// containing the last timestamp; within that day only hh:mm:ss is computed,
+// from the offset since midnight. Days that are not 24 hours long (DST
+// changes) are never cached.
+void format_timestamp_cached(TimestampCache *cache, time_t timestamp, char *buffer,
+                             size_t buffer_size)
+{
+    if (timestamp < cache->day_start || timestamp >= cache->day_end)
+    {
+        struct tm tm_info;
+        localtime_r(&timestamp, &tm_info);
+        strftime(cache->date, sizeof(cache->date), "%Y-%m-%d", &tm_info);
+
+        struct tm midnight = tm_info;
+        midnight.tm_hour = midnight.tm_min = midnight.tm_sec = 0;
+        midnight.tm_isdst = -1;
+        time_t start = mktime(&midnight);
+        midnight.tm_mday++;
+        midnight.tm_hour = midnight.tm_min = midnight.tm_sec = 0;
+        midnight.tm_isdst = -1;
+        time_t end = mktime(&midnight);
+        if (start == (time_t)-1 || end - start != SECONDS_PER_DAY || timestamp < start)
+        {
+            cache->day_start = cache->day_end = 0;
+            strftime(buffer, buffer_size, "%Y-%m-%d %H:%M:%S", &tm_info);
+            return;
+        }
+        cache->day_start = start;
+        cache->day_end = end;
+    }
+
+    int seconds = (int)(timestamp - cache->day_start);
+    snprintf(buffer, buffer_size, "%s %02d:%02d:%02d", cache->date, seconds / 3600,
+             seconds / 60 % 60, seconds % 60);
 }
 
 int get_history_count(const CalculationHistory *hist)
@@ -1,11 +1,40 @@
 #ifndef HISTORY_H
 #define HISTORY_H
 
+#include <stdio.h>
 #include "calculator.h"
+#include "arena.h"
+#include "history_index.h"
+#include "utils.h"
 
 #define INITIAL_HISTORY_CAPACITY 5
+#define HISTORY_GROWTH_FACTOR 2.0 // Default capacity multiplier when the array is full
+
+// Levels for CalculationHistory.verbose
+#define HISTORY_VERBOSE_QUIET 0
+#define HISTORY_VERBOSE_INFO 1   // Loads, saves and imports
+#define HISTORY_VERBOSE_DETAIL 2 // Also every change of capacity
 #define MAX_EXPRESSION_LENGTH 256
-#define DEFAULT_HISTORY_FILE "history.csv"
+#define DEFAULT_HISTORY_FILE "history.dat"
+#define DEFAULT_CSV_FILE "history.csv"
+#define HISTORY_CSV_HEADER "Timestamp ,Expression ,Result ,Error \n"
+
+// Binary history file format (all integers little-endian):
+//   file header:  8-byte magic, u32 version, u32 reserved
+//   block header: u32 record count, u32 payload size, u32 CRC-32 of payload
+//   record:       i64 timestamp, f64 result, i8 status, u32 expression length,
+//                 expression bytes (not NUL-terminated)
+#define HISTORY_FILE_MAGIC "CALCHIST"
+#define HISTORY_FILE_VERSION 1
+#define HISTORY_FILE_HEADER_SIZE 16
+#define HISTORY_BLOCK_HEADER_SIZE 12
+#define HISTORY_RECORD_HEADER_SIZE 21
+#define HISTORY_BLOCK_RECORDS 4096 // Records per block when saving
+
+// Journal (append-only persistence) settings
+#define JOURNAL_BUFFER_SIZE (64 * 1024)  // Largest pending block
+#define DEFAULT_JOURNAL_SYNC_INTERVAL 32 // Records per block and fsync
+#define HISTORY_EVICT_DIVISOR 4          // A memory limit of N evicts N / 4 extra entries at a time
 
 typedef enum
 {
@@ -15,35 +44,127 @@ typedef enum
     HISTORY_INVALID_INDEX = -3
 } HistoryResult;
 
-// Structure to manage the dynamic history array
+#define TIMESTAMP_STRING_SIZE 20      // "YYYY-MM-DD hh:mm:ss"
+#define SECONDS_PER_DAY 86400
+#define DISPLAY_BUFFER_SIZE (64 * 1024) // Output buffered per display call
+
+// Date text of the local day last formatted, so entries from the same day
+// skip localtime
 typedef struct
 {
-    Calculation *calculations; // Dynamic array
-    int count;                 // Current number of entries
+    time_t day_start; // Local midnight
+    time_t day_end;   // Next local midnight
+    char date[11];    // "YYYY-MM-DD"
+} TimestampCache;
+
+#define REPLAY_TASK_ENTRIES 4096 // Entries per parallel replay task
+
+// Outcome of re-evaluating entries [first, first + count)
+typedef struct
+{
+    int first;
+    int count;
+    double *results;         // Recomputed result per entry (0 on error)
+    signed char *statuses;   // Recomputed CalcResult per entry
+    HistoryMatches diverged; // Entries whose status or result changed
+} ReplayReport;
+
+// Append-only persistence state, private to history.c
+typedef struct HistoryJournal HistoryJournal;
+
+// Structure to manage the dynamic history array.
+// The index refers into the struct, so it must not be moved once initialised.
+// With a memory limit only the newest entries are resident: calculations[k]
+// is entry first_resident + k, and older entries are read back from the
+// journal file (see history_entry).
+typedef struct
+{
+    Calculation *calculations; // Dynamic array of the resident entries
+    StringArena strings;       // Backing store for every entry's strings
+    HistoryIndex index;        // Expression and result search index
+    int index_complete;        // Every resident entry is indexed; if not, queries scan
+    FixedPool postings_pool;   // Short index posting lists (the index points here)
+    int count;                 // Current number of entries, resident or not
+    int first_resident;        // Entries before this one were evicted to the journal file
+    int memory_limit;          // Most entries kept in memory, 0 for no limit
     int capacity;              // Current allocated capacity
+    int verbose;               // HISTORY_VERBOSE_* level of messages on stdout
+    double growth_factor;      // Capacity multiplier when full; at least adds one entry
+    int timestamps_sorted;     // Entries are in timestamp order (enables time windows by binary search)
+    HistoryJournal *journal;   // Incremental persistence, or NULL
 } CalculationHistory;
 
 // Core history management functions
 HistoryResult init_history(CalculationHistory *hist);
 HistoryResult add_calculation(CalculationHistory *hist, const char *expr,
-                              const char *result, int is_error);
+                              double result, CalcResult status);
 void cleanup_history(CalculationHistory *hist);
+// The caller owns calc->expression_str and releases it with safe_free
 HistoryResult parse_csv_line(const char *line, Calculation *calc);
 
 // Display functions
 void display_history(const CalculationHistory *hist);
 void display_history_entry(const CalculationHistory *hist, int index);
+void display_history_range(const CalculationHistory *hist, int first, int count);
+void write_calculation(OutputBuffer *out, TimestampCache *times, const Calculation *calc,
+                       int number);
+int display_history_window(const CalculationHistory *hist, time_t since, time_t until);
+void display_history_matches(const CalculationHistory *hist, const HistoryMatches *matches,
+                             int limit);
+
+// Entry by index: resident entries directly, evicted ones paged in from the
+// journal file a block at a time. A paged entry stays valid until the next
+// call; NULL if index is out of range or the file cannot be read.
+const Calculation *history_entry(const CalculationHistory *hist, int index);
 
-// File operations
+// Indexed queries; matches are appended to the caller's list. Only resident
+// entries are indexed, so evicted entries are not searched. While the index
+// is incomplete the resident entries are scanned instead.
+HistoryResult search_history(const CalculationHistory *hist, const char *pattern,
+                             HistoryMatches *matches);
+HistoryResult find_history_by_result(CalculationHistory *hist, const char *op, double value,
+                                     HistoryMatches *matches);
+
+// File operations (binary format)
 HistoryResult save_history_to_file(const CalculationHistory *hist, const char *filename);
 HistoryResult load_history_from_file(CalculationHistory *hist, const char *filename);
 
+// CSV interchange
+HistoryResult export_history_csv(const CalculationHistory *hist, const char *filename);
+HistoryResult import_history_csv(CalculationHistory *hist, const char *filename);
+
+// Incremental persistence: once attached, every added entry is appended to
+// the file in checksummed blocks, and a full rewrite only happens on
+// compaction (e.g. after clear)
+HistoryResult attach_history_journal(CalculationHistory *hist, const char *filename,
+                                     int sync_interval);
+HistoryResult flush_history_journal(CalculationHistory *hist);
+HistoryResult compact_history_journal(CalculationHistory *hist);
+void detach_history_journal(CalculationHistory *hist);
+
+// Keep at most limit entries in memory (0: no limit). Needs an attached
+// journal, which must stay attached while entries are evicted: once more
+// than limit entries are resident, the oldest are flushed to the journal
+// file and dropped from memory in one batch.
+HistoryResult set_history_memory_limit(CalculationHistory *hist, int limit);
+
 // History management commands
 HistoryResult clear_history(CalculationHistory *hist);
-HistoryResult replay_calculation(const CalculationHistory *hist, int index, char *result);
+// Make room for capacity entries in one allocation (never shrinks)
+HistoryResult reserve_history(CalculationHistory *hist, int capacity);
+// Give back unused entry capacity and, when empty, the index pool
+HistoryResult shrink_history(CalculationHistory *hist);
+HistoryResult replay_calculation(const CalculationHistory *hist, int index, double *result,
+                                 CalcResult *status);
+HistoryResult replay_history(const CalculationHistory *hist, int first, int count, int threads,
+                             ReplayReport *report);
+void free_replay_report(ReplayReport *report);
 
 // Utility functions
 void format_timestamp(time_t timestamp, char *buffer, size_t buffer_size);
+void timestamp_cache_init(TimestampCache *cache);
+void format_timestamp_cached(TimestampCache *cache, time_t timestamp, char *buffer,
+                             size_t buffer_size);
 int get_history_count(const CalculationHistory *hist);
 
 #endif // HISTORY_H
\ No newline at end of file
@@ -0,0 +1,297 @@
+#include <stdlib.h>
+#include <string.h>
+#include "history_index.h"
+#include "utils.h"
+
+void history_matches_init(HistoryMatches *matches)
+{
+    matches->entries = NULL;
+    matches->count = 0;
+    matches->capacity = 0;
+}
+
+int history_matches_add(HistoryMatches *matches, int entry)
+{
+    if (matches->count >= matches->capacity)
+    {
+        int new_capacity = matches->capacity > 0 ? matches->capacity * 2 : 16;
+        int *temp = safe_realloc(matches->entries, new_capacity * sizeof(int));
+        if (temp == NULL)
+            return 0;
+        matches->entries = temp;
+        matches->capacity = new_capacity;
+    }
+    matches->entries[matches->count++] = entry;
+    return 1;
+}
+
+void history_matches_free(HistoryMatches *matches)
+{
+    safe_free(matches->entries);
+    history_matches_init(matches);
+}
+
+void history_index_init(HistoryIndex *index, CalcAllocator postings_memory)
+{
+    memset(index, 0, sizeof(*index));
+    index->postings_memory = postings_memory;
+}
+
+// Empty the index; it stays usable with the same allocator
+void history_index_free(HistoryIndex *index)
+{
+    for (size_t i = 0; i < index->trigram_slots; i++)
+        calc_release(&index->postings_memory, index->trigrams[i].entries,
+                     index->trigrams[i].capacity * sizeof(int));
+    safe_free(index->trigrams);
+    safe_free(index->results);
+    safe_free(index->merge_scratch);
+    history_index_init(index, index->postings_memory);
+}
+
+static unsigned int pack_trigram(const char *text)
+{
+    const unsigned char *p = (const unsigned char *)text;
+    return ((unsigned int)p[0] << 16) | ((unsigned int)p[1] << 8) | p[2];
+}
+
+static size_t trigram_slot(const HistoryIndex *index, unsigned int trigram)
+{
+    size_t mask = index->trigram_slots - 1;
+    size_t slot = (trigram * 2654435761u) & mask;
+    while (index->trigrams[slot].trigram != 0 && index->trigrams[slot].trigram != trigram)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+// Double the trigram table; posting lists move over unchanged
+static int grow_trigrams(HistoryIndex *index)
+{
+    size_t old_slots = index->trigram_slots;
+    TrigramPostings *old = index->trigrams;
+    size_t new_slots = old_slots > 0 ? old_slots * 2 : HISTORY_INDEX_INITIAL_SLOTS;
+
+    TrigramPostings *table = safe_calloc(new_slots, sizeof(TrigramPostings));
+    if (table == NULL)
+        return 0;
+    index->trigrams = table;
+    index->trigram_slots = new_slots;
+    for (size_t i = 0; i < old_slots; i++)
+    {
+        if (old[i].trigram != 0)
+            index->trigrams[trigram_slot(index, old[i].trigram)] = old[i];
+    }
+    safe_free(old);
+    return 1;
+}
+
+static int add_posting(HistoryIndex *index, unsigned int trigram, int entry)
+{
+    // Keep the table at most half full
+    if ((index->trigram_count + 1) * 2 > index->trigram_slots && !grow_trigrams(index))
+        return 0;
+
+    TrigramPostings *postings = &index->trigrams[trigram_slot(index, trigram)];
+    if (postings->trigram == 0)
+    {
+        postings->trigram = trigram;
+        index->trigram_count++;
+    }
+    // Entries are added in order, so a repeat within one entry is always last
+    if (postings->count > 0 && postings->entries[postings->count - 1] == entry)
+        return 1;
+
+    if (postings->count >= postings->capacity)
+    {
+        int new_capacity = postings->capacity > 0 ? postings->capacity * 2 : 4;
+        int *temp = calc_reallocate(&index->postings_memory, postings->entries,
+                                    postings->capacity * sizeof(int), new_capacity * sizeof(int));
+        if (temp == NULL)
+            return 0;
+        postings->entries = temp;
+        postings->capacity = new_capacity;
+    }
+    postings->entries[postings->count++] = entry;
+    return 1;
+}
+
+static int compare_result_keys(const void *a, const void *b)
+{
+    const ResultKey *x = a;
+    const ResultKey *y = b;
+    if (x->value != y->value)
+        return x->value < y->value ? -1 : 1;
+    return x->entry - y->entry;
+}
+
+// Sort the tail and merge it into the sorted run. The merge runs backwards
+// through the results array, so only the tail needs room elsewhere.
+static int merge_result_tail(HistoryIndex *index)
+{
+    int tail = index->result_count - index->result_sorted;
+    if (tail == 0)
+        return 1;
+
+    // The tail is usually just over the threshold, but keys keep being
+    // appended while merges fail
+    if (tail > index->merge_scratch_capacity)
+    {
+        int capacity = tail > HISTORY_INDEX_MERGE_THRESHOLD + 1 ? tail : HISTORY_INDEX_MERGE_THRESHOLD + 1;
+        ResultKey *scratch = safe_realloc(index->merge_scratch, (size_t)capacity * sizeof(ResultKey));
+        if (scratch == NULL)
+            return 0;
+        index->merge_scratch = scratch;
+        index->merge_scratch_capacity = capacity;
+    }
+    ResultKey *run = index->results;
+    ResultKey *added = index->merge_scratch;
+    qsort(run + index->result_sorted, tail, sizeof(ResultKey), compare_result_keys);
+    memcpy(added, run + index->result_sorted, tail * sizeof(ResultKey));
+
+    int i = index->result_sorted - 1, j = tail - 1, k = index->result_count - 1;
+    while (j >= 0)
+        run[k--] = i >= 0 && compare_result_keys(&run[i], &added[j]) > 0 ? run[i--] : added[j--];
+
+    index->result_sorted = index->result_count;
+    return 1;
+}
+
+int history_index_reserve_results(HistoryIndex *index, int capacity)
+{
+    if (capacity <= index->result_capacity)
+        return 1;
+    ResultKey *temp = safe_realloc(index->results, (size_t)capacity * sizeof(ResultKey));
+    if (temp == NULL)
+        return 0;
+    index->results = temp;
+    index->result_capacity = capacity;
+    return 1;
+}
+
+int history_index_add(HistoryIndex *index, int entry, const char *text, size_t length,
+                      int has_result, double result)
+{
+    for (size_t i = 0; i + 3 <= length; i++)
+    {
+        if (!add_posting(index, pack_trigram(text + i), entry))
+            return 0;
+    }
+    if (!has_result || result != result) // NaN has no place in the order
+        return 1;
+
+    if (index->result_count >= index->result_capacity &&
+        !history_index_reserve_results(index, index->result_capacity > 0 ? index->result_capacity * 2 : 64))
+        return 0;
+    index->results[index->result_count].value = result;
+    index->results[index->result_count].entry = entry;
+    index->result_count++;
+    if (index->result_count - index->result_sorted > HISTORY_INDEX_MERGE_THRESHOLD)
+        return merge_result_tail(index);
+    return 1;
+}
+
+static int compare_postings_by_count(const void *a, const void *b)
+{
+    const TrigramPostings *x = *(const TrigramPostings *const *)a;
+    const TrigramPostings *y = *(const TrigramPostings *const *)b;
+    return x->count - y->count;
+}
+
+int history_index_candidates(const HistoryIndex *index, const char *pattern, size_t length,
+                             HistoryMatches *out)
+{
+    if (length < 3)
+        return 0;
+    if (index->trigram_slots == 0)
+        return 1; // Nothing indexed yet, so nothing can match
+
+    size_t list_count = length - 2;
+    const TrigramPostings **lists = safe_malloc(list_count * sizeof(*lists));
+    if (lists == NULL)
+        return 0;
+    for (size_t i = 0; i < list_count; i++)
+    {
+        const TrigramPostings *postings = &index->trigrams[trigram_slot(index, pack_trigram(pattern + i))];
+        if (postings->trigram == 0)
+        {
+            safe_free(lists);
+            return 1; // A trigram no entry contains
+        }
+        lists[i] = postings;
+    }
+
+    // Intersect starting from the rarest trigram so the candidate set only shrinks
+    qsort(lists, list_count, sizeof(*lists), compare_postings_by_count);
+    for (int i = 0; i < lists[0]->count; i++)
+    {
+        if (!history_matches_add(out, lists[0]->entries[i]))
+            break;
+    }
+    for (size_t l = 1; l < list_count && out->count > 0; l++)
+    {
+        const TrigramPostings *postings = lists[l];
+        int kept = 0;
+        int j = 0;
+        for (int i = 0; i < out->count; i++)
+        {
+            while (j < postings->count && postings->entries[j] < out->entries[i])
+                j++;
+            if (j < postings->count && postings->entries[j] == out->entries[i])
+                out->entries[kept++] = out->entries[i];
+        }
+        out->count = kept;
+    }
+    safe_free(lists);
+    return 1;
+}
+
+static int in_range(double value, double low, int low_inclusive, double high, int high_inclusive)
+{
+    return (low_inclusive ? value >= low : value > low) &&
+           (high_inclusive ? value <= high : value < high);
+}
+
+int history_index_results(HistoryIndex *index, double low, int low_inclusive,
+                          double high, int high_inclusive, HistoryMatches *out)
+{
+    // Binary search the sorted run for the first key above the lower bound
+    int lo = 0, hi = index->result_sorted;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        double value = index->results[mid].value;
+        if (low_inclusive ? value < low : value <= low)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    int end = lo;
+    while (end < index->result_sorted &&
+           in_range(index->results[end].value, low, low_inclusive, high, high_inclusive))
+        end++;
+
+    // The tail is short: scan it and merge its matches into the run's
+    int tail = index->result_count - index->result_sorted;
+    ResultKey *extra = tail > 0 ? safe_malloc(tail * sizeof(ResultKey)) : NULL;
+    if (tail > 0 && extra == NULL)
+        return 0;
+    int extra_count = 0;
+    for (int i = index->result_sorted; i < index->result_count; i++)
+    {
+        if (in_range(index->results[i].value, low, low_inclusive, high, high_inclusive))
+            extra[extra_count++] = index->results[i];
+    }
+    qsort(extra, extra_count, sizeof(ResultKey), compare_result_keys);
+
+    int ok = 1;
+    int i = lo, j = 0;
+    while (ok && (i < end || j < extra_count))
+    {
+        if (j == extra_count || (i < end && compare_result_keys(&index->results[i], &extra[j]) <= 0))
+            ok = history_matches_add(out, index->results[i++].entry);
+        else
+            ok = history_matches_add(out, extra[j++].entry);
+    }
+    safe_free(extra);
+    return ok;
+}
@@ -0,0 +1,75 @@
+#ifndef HISTORY_INDEX_H
+#define HISTORY_INDEX_H
+
+#include <stddef.h>
+#include "allocator.h"
+
+// Unsorted result keys kept beside the sorted run before they are merged in
+#define HISTORY_INDEX_MERGE_THRESHOLD 4096
+#define HISTORY_INDEX_INITIAL_SLOTS 1024
+#define HISTORY_INDEX_POSTINGS_BLOCK 64 // Bytes of postings a pool block holds (16 entries)
+
+// Entries whose expression contains one trigram, in ascending entry order
+typedef struct
+{
+    unsigned int trigram; // Three bytes packed, 0 marks an empty slot
+    int count;
+    int capacity;
+    int *entries;
+} TrigramPostings;
+
+typedef struct
+{
+    double value;
+    int entry;
+} ResultKey;
+
+// Search index over history entries, maintained as entries are appended.
+// Expression text is indexed by trigram; successful results are kept in a
+// sorted run plus a short unsorted tail of recent additions.
+typedef struct
+{
+    TrigramPostings *trigrams; // Open-addressed table keyed by trigram
+    size_t trigram_slots;      // Power of two
+    size_t trigram_count;
+    ResultKey *results;
+    int result_count;
+    int result_sorted; // results[0, result_sorted) is ordered by value
+    int result_capacity;
+    ResultKey *merge_scratch;       // Sorted tail during a merge, reused between merges
+    int merge_scratch_capacity;
+    CalcAllocator postings_memory;  // Where posting lists live
+} HistoryIndex;
+
+// Entry numbers produced by a query
+typedef struct
+{
+    int *entries;
+    int count;
+    int capacity;
+} HistoryMatches;
+
+// Most posting lists stay short, so callers usually hand in a FixedPool of
+// HISTORY_INDEX_POSTINGS_BLOCK-byte blocks
+void history_index_init(HistoryIndex *index, CalcAllocator postings_memory);
+void history_index_free(HistoryIndex *index);
+// Room for capacity result keys, so a bulk load grows the array once
+int history_index_reserve_results(HistoryIndex *index, int capacity);
+int history_index_add(HistoryIndex *index, int entry, const char *text, size_t length,
+                      int has_result, double result);
+
+// Entries that contain every trigram of pattern, ascending. Returns 0 when
+// the pattern is too short to use the index; the caller then scans.
+// Candidates still need a substring check.
+int history_index_candidates(const HistoryIndex *index, const char *pattern, size_t length,
+                             HistoryMatches *out);
+
+// Entries whose result lies between low and high, ordered by result
+int history_index_results(HistoryIndex *index, double low, int low_inclusive,
+                          double high, int high_inclusive, HistoryMatches *out);
+
+void history_matches_init(HistoryMatches *matches);
+int history_matches_add(HistoryMatches *matches, int entry);
+void history_matches_free(HistoryMatches *matches);
+
+#endif // HISTORY_INDEX_H
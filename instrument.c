@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "instrument.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+const char *const PROFILE_TICK_UNIT = "cycles";
+#else
+const char *const PROFILE_TICK_UNIT = "ns";
+#endif
+
+// Call site slot; file is published last, so a non-NULL file means line is set
+typedef struct
+{
+    _Atomic(const char *) file;
+    int line;
+    atomic_size_t allocations;
+    atomic_size_t bytes;
+    atomic_size_t live_bytes;
+} SiteSlot;
+
+typedef struct
+{
+    atomic_uint_fast64_t calls;
+    atomic_uint_fast64_t ticks;
+    atomic_uint_fast64_t max_ticks;
+} ZoneSlot;
+
+static const char *const zone_names[PROFILE_ZONE_COUNT] = {
+    "parse_expression", "add_calculation", "load_history_from_file", "save_history_to_file"};
+
+// One extra slot collects sites that no longer fit in the table
+static SiteSlot sites[INSTRUMENT_MAX_SITES + 1];
+static pthread_mutex_t site_lock = PTHREAD_MUTEX_INITIALIZER;
+static ZoneSlot zones[PROFILE_ZONE_COUNT];
+
+static atomic_size_t allocation_count;
+static atomic_size_t free_count;
+static atomic_size_t allocated_bytes;
+static atomic_size_t live_bytes;
+static atomic_size_t peak_bytes;
+
+static size_t site_hash(const char *file, int line)
+{
+    uintptr_t key = (uintptr_t)file ^ ((uintptr_t)line * 0x9E3779B97F4A7C15ULL);
+    return (size_t)(key ^ (key >> 17)) % INSTRUMENT_MAX_SITES;
+}
+
+// Index of the slot for file:line. __FILE__ is one string per translation
+// unit, so the pointer identifies the file.
+int instrument_site(const char *file, int line)
+{
+    size_t slot = site_hash(file, line);
+    for (size_t probe = 0; probe < INSTRUMENT_MAX_SITES; probe++)
+    {
+        SiteSlot *site = &sites[slot];
+        const char *owner = atomic_load_explicit(&site->file, memory_order_acquire);
+        if (owner == NULL)
+        {
+            // First allocation from this site: claim the slot under the lock
+            pthread_mutex_lock(&site_lock);
+            owner = atomic_load_explicit(&site->file, memory_order_relaxed);
+            if (owner == NULL)
+            {
+                site->line = line;
+                atomic_store_explicit(&site->file, file, memory_order_release);
+                owner = file;
+            }
+            pthread_mutex_unlock(&site_lock);
+        }
+        if (owner == file && site->line == line)
+            return (int)slot;
+        slot = (slot + 1) % INSTRUMENT_MAX_SITES;
+    }
+    return INSTRUMENT_MAX_SITES;
+}
+
+void instrument_allocated(int site, size_t bytes)
+{
+    atomic_fetch_add_explicit(&allocation_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&allocated_bytes, bytes, memory_order_relaxed);
+    size_t live = atomic_fetch_add_explicit(&live_bytes, bytes, memory_order_relaxed) + bytes;
+    size_t peak = atomic_load_explicit(&peak_bytes, memory_order_relaxed);
+    while (live > peak &&
+           !atomic_compare_exchange_weak_explicit(&peak_bytes, &peak, live, memory_order_relaxed,
+                                                  memory_order_relaxed))
+        ;
+
+    atomic_fetch_add_explicit(&sites[site].allocations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sites[site].bytes, bytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&sites[site].live_bytes, bytes, memory_order_relaxed);
+}
+
+void instrument_released(int site, size_t bytes)
+{
+    atomic_fetch_add_explicit(&free_count, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&live_bytes, bytes, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&sites[site].live_bytes, bytes, memory_order_relaxed);
+}
+
+uint64_t profile_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void profile_record(ProfileZone zone, uint64_t start)
+{
+    uint64_t elapsed = profile_ticks() - start;
+    ZoneSlot *slot = &zones[zone];
+    atomic_fetch_add_explicit(&slot->calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&slot->ticks, elapsed, memory_order_relaxed);
+    uint_fast64_t max = atomic_load_explicit(&slot->max_ticks, memory_order_relaxed);
+    while (elapsed > max &&
+           !atomic_compare_exchange_weak_explicit(&slot->max_ticks, &max, elapsed, memory_order_relaxed,
+                                                  memory_order_relaxed))
+        ;
+}
+
+void instrument_allocation_stats(AllocationStats *stats)
+{
+    stats->allocations = atomic_load(&allocation_count);
+    stats->frees = atomic_load(&free_count);
+    stats->bytes = atomic_load(&allocated_bytes);
+    stats->live_bytes = atomic_load(&live_bytes);
+    stats->peak_bytes = atomic_load(&peak_bytes);
+}
+
+static int compare_sites(const void *a, const void *b)
+{
+    size_t x = ((const AllocationSite *)a)->bytes, y = ((const AllocationSite *)b)->bytes;
+    return (x < y) - (x > y);
+}
+
+size_t instrument_top_sites(AllocationSite *out, size_t max_sites)
+{
+    AllocationSite all[INSTRUMENT_MAX_SITES + 1];
+    size_t count = 0;
+    for (size_t i = 0; i <= INSTRUMENT_MAX_SITES; i++)
+    {
+        size_t allocations = atomic_load_explicit(&sites[i].allocations, memory_order_relaxed);
+        if (allocations == 0)
+            continue;
+        const char *file = atomic_load_explicit(&sites[i].file, memory_order_acquire);
+        all[count].file = file != NULL ? file : "(other)";
+        all[count].line = file != NULL ? sites[i].line : 0;
+        all[count].allocations = allocations;
+        all[count].bytes = atomic_load_explicit(&sites[i].bytes, memory_order_relaxed);
+        all[count].live_bytes = atomic_load_explicit(&sites[i].live_bytes, memory_order_relaxed);
+        count++;
+    }
+    qsort(all, count, sizeof(AllocationSite), compare_sites);
+    if (count > max_sites)
+        count = max_sites;
+    memcpy(out, all, count * sizeof(AllocationSite));
+    return count;
+}
+
+void instrument_zone_stats(ProfileZone zone, ProfileZoneStats *stats)
+{
+    stats->name = zone_names[zone];
+    stats->calls = atomic_load(&zones[zone].calls);
+    stats->ticks = atomic_load(&zones[zone].ticks);
+    stats->max_ticks = atomic_load(&zones[zone].max_ticks);
+}
+
+void instrument_report(FILE *stream)
+{
+    AllocationStats totals;
+    instrument_allocation_stats(&totals);
+    fprintf(stream, "Allocations: %zu (%zu freed), %zu bytes requested\n", totals.allocations,
+            totals.frees, totals.bytes);
+    fprintf(stream, " live: %zu bytes, peak: %zu bytes\n", totals.live_bytes, totals.peak_bytes);
+
+    AllocationSite top[INSTRUMENT_REPORT_SITES];
+    size_t count = instrument_top_sites(top, INSTRUMENT_REPORT_SITES);
+    for (size_t i = 0; i < count; i++)
+        fprintf(stream, " %s:%d: %zu allocations, %zu bytes, %zu live\n", top[i].file, top[i].line,
+                top[i].allocations, top[i].bytes, top[i].live_bytes);
+
+    fprintf(stream, "Timings (%s):\n", PROFILE_TICK_UNIT);
+    for (int zone = 0; zone < PROFILE_ZONE_COUNT; zone++)
+    {
+        ProfileZoneStats stats;
+        instrument_zone_stats((ProfileZone)zone, &stats);
+        fprintf(stream, " %s: %llu calls", stats.name, (unsigned long long)stats.calls);
+        if (stats.calls > 0)
+            fprintf(stream, ", %llu avg, %llu max", (unsigned long long)(stats.ticks / stats.calls),
+                    (unsigned long long)stats.max_ticks);
+        fprintf(stream, "\n");
+    }
+}
+
+static void dump_at_exit(void)
+{
+    instrument_report(stderr);
+}
+
+void instrument_init(void)
+{
+    const char *value = getenv(INSTRUMENT_ENV);
+    if (value != NULL && value[0] != '\0' && strcmp(value, "0") != 0)
+        atexit(dump_at_exit);
+}
@@ -0,0 +1,72 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define INSTRUMENT_MAX_SITES 512    // Distinct allocation call sites tracked
+#define INSTRUMENT_REPORT_SITES 10  // Call sites listed by instrument_report
+#define INSTRUMENT_ENV "CALC_STATS" // Set to dump the report to stderr at exit
+
+// Timed regions of the hot paths
+typedef enum
+{
+    PROFILE_PARSE_EXPRESSION = 0,
+    PROFILE_ADD_CALCULATION,
+    PROFILE_LOAD_HISTORY,
+    PROFILE_SAVE_HISTORY,
+    PROFILE_ZONE_COUNT
+} ProfileZone;
+
+// Process-wide allocation totals
+typedef struct
+{
+    size_t allocations; // A realloc counts as one free and one allocation
+    size_t frees;
+    size_t bytes;       // Bytes requested in total
+    size_t live_bytes;  // Bytes currently allocated
+    size_t peak_bytes;  // Highest live_bytes seen
+} AllocationStats;
+
+// Totals for one call site of safe_malloc and friends
+typedef struct
+{
+    const char *file;
+    int line;
+    size_t allocations;
+    size_t bytes;
+    size_t live_bytes;
+} AllocationSite;
+
+typedef struct
+{
+    const char *name;
+    uint64_t calls;
+    uint64_t ticks;     // Total, in PROFILE_TICK_UNIT
+    uint64_t max_ticks; // Slowest single call
+} ProfileZoneStats;
+
+// Hooks for the allocator in utils.c. Thread-safe.
+int instrument_site(const char *file, int line);
+void instrument_allocated(int site, size_t bytes);
+void instrument_released(int site, size_t bytes);
+
+// Zone timing: ticks = profile_ticks(); ...; profile_record(zone, ticks).
+// Ticks are TSC cycles on x86 and nanoseconds elsewhere.
+uint64_t profile_ticks(void);
+void profile_record(ProfileZone zone, uint64_t start);
+extern const char *const PROFILE_TICK_UNIT;
+
+void instrument_allocation_stats(AllocationStats *stats);
+// Call sites with the most bytes allocated, largest first; returns how many
+size_t instrument_top_sites(AllocationSite *sites, size_t max_sites);
+void instrument_zone_stats(ProfileZone zone, ProfileZoneStats *stats);
+
+// Allocation totals, the busiest call sites and every zone
+void instrument_report(FILE *stream);
+
+// Register the exit-time dump if INSTRUMENT_ENV is set
+void instrument_init(void);
+
+#endif // INSTRUMENT_H
@@ -2,11 +2,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <time.h>
 #include "calculator.h"
 #include "history.h"
 #include "utils.h"
+#include "batch.h"
+#include "cache.h"
+#include "thread_pool.h"
+#include "server.h"
+#include "instrument.h"
 
 #define BUFFER_SIZE 512
+#define SEARCH_DISPLAY_LIMIT 20 // Matches printed per search
+#define HISTORY_PAGE_SIZE 20    // Entries per page when no limit is given
+#define REPLAY_DISPLAY_LIMIT 20 // Divergent entries listed per replay
+#define REPLAY_USAGE "Error: Usage : replay N | replay A..B | replay all"
 
 // ANSI color codes for terminal output
 #define KRED "\x1B[31m"
@@ -15,26 +26,108 @@
 // Function prototypes for command handling
 static void display_welcome(void);
 static void display_help(void);
-static int handle_command(CalculationHistory *hist, const char *input);
-static int handle_expression(CalculationHistory *hist, const char *input);
-
-int main()
+static int handle_command(CalculationHistory *hist, ExpressionCache *cache, const char *input);
+static int handle_expression(CalculationHistory *hist, ExpressionCache *cache, const char *input);
+static int run_batch_mode(const char *filename, int record_history, int sync_interval,
+                          int memory_limit, size_t cache_size, int threads);
+static void display_usage(const char *program);
+static void open_history(CalculationHistory *hist, int sync_interval, int memory_limit);
+static int run_server_mode(const char *socket_path, int sync_interval, int memory_limit,
+                           size_t cache_size);
+static void handle_history_view(const CalculationHistory *hist, const char *args);
+static void replay_single(const CalculationHistory *hist, int index);
+static void replay_range(const CalculationHistory *hist, int first, int count);
+
+int main(int argc, char **argv)
 {
     CalculationHistory history;
+    ExpressionCache cache;
     char input[BUFFER_SIZE];
 
+    // Parse command-line options
+    int batch_mode = 0;
+    int record_history = 1;
+    int sync_interval = DEFAULT_JOURNAL_SYNC_INTERVAL;
+    int memory_limit = 0;
+    size_t cache_size = DEFAULT_CACHE_CAPACITY;
+    int threads = thread_pool_default_size();
+    const char *batch_file = NULL;
+    int verbose = HISTORY_VERBOSE_INFO;
+    const char *socket_path = NULL;
+    instrument_init(); // CALC_STATS=1 prints allocation and timing stats at exit
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--batch") == 0)
+        {
+            batch_mode = 1;
+        }
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+        {
+            socket_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-history") == 0)
+        {
+            record_history = 0;
+        }
+        else if (strcmp(argv[i], "--verbose") == 0)
+        {
+            verbose = HISTORY_VERBOSE_DETAIL;
+        }
+        else if (strcmp(argv[i], "--sync-every") == 0 && i + 1 < argc && is_valid_number(argv[i + 1]))
+        {
+            sync_interval = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--memory-limit") == 0 && i + 1 < argc && is_valid_number(argv[i + 1]))
+        {
+            memory_limit = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc && is_valid_number(argv[i + 1]))
+        {
+            cache_size = (size_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc && is_valid_number(argv[i + 1]))
+        {
+            threads = atoi(argv[++i]);
+        }
+        else if (batch_mode && batch_file == NULL && argv[i][0] != '-')
+        {
+            batch_file = argv[i];
+        }
+        else
+        {
+            display_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (socket_path != NULL)
+    {
+        return run_server_mode(socket_path, sync_interval, memory_limit, cache_size);
+    }
+    if (batch_mode)
+    {
+        return run_batch_mode(batch_file, record_history, sync_interval, memory_limit, cache_size,
+                              threads);
+    }
+
     // Initialize history
     if (init_history(&history) != HISTORY_SUCCESS)
     {
         print_error("Failed to initialize history");
         return 1;
     }
+    history.verbose = verbose;
+    if (!expression_cache_init(&cache, cache_size))
+    {
+        print_error("Failed to initialize expression cache");
+        cleanup_history(&history);
+        return 1;
+    }
     // Display welcome message
     display_welcome();
 
     // Load previous history
     printf("Loading previous history ...\n");
-    load_history_from_file(&history, DEFAULT_HISTORY_FILE);
+    open_history(&history, sync_interval, memory_limit);
 
     // Main program loop
     while (1)
@@ -61,7 +154,7 @@ int main()
         if (strcmp(input, "Q") == 0 || strcmp(input, "q") == 0)
         {
             printf("Saving history ...\n");
-            if (save_history_to_file(&history, DEFAULT_HISTORY_FILE) == HISTORY_SUCCESS)
+            if (flush_history_journal(&history) == HISTORY_SUCCESS)
             {
                 printf("History saved successfully .\n");
             }
@@ -70,17 +163,150 @@ int main()
         }
 
         // Try to handle as command first , then as expression
-        if (!handle_command(&history, input))
+        if (!handle_command(&history, &cache, input))
         {
-            handle_expression(&history, input);
+            handle_expression(&history, &cache, input);
         }
     }
 
     // Cleanup
+    expression_cache_free(&cache);
     cleanup_history(&history);
     return 0;
 }
 
+static void display_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--batch [file]] [--no-history] [--sync-every N] [--memory-limit N] [--cache-size N] [--threads N] [--verbose]\n", program);
+    fprintf(stderr, "       %s --serve SOCKET [--sync-every N] [--memory-limit N] [--cache-size N]\n", program);
+    fprintf(stderr, "  --batch [file]    Evaluate one expression per line from file (default stdin)\n");
+    fprintf(stderr, "  --no-history      Do not load, record or save history in batch mode\n");
+    fprintf(stderr, "  --sync-every N    fsync the history file every N records (0: only on exit)\n");
+    fprintf(stderr, "  --memory-limit N  Keep only the newest N history entries in memory (0: all)\n");
+    fprintf(stderr, "  --cache-size N    Remember results of the last N distinct expressions (0: off)\n");
+    fprintf(stderr, "  --threads N       Batch evaluation threads (default: one per core)\n");
+    fprintf(stderr, "  --serve SOCKET    Answer expressions from clients on a Unix domain socket\n");
+    fprintf(stderr, "  --verbose         Also report history capacity changes (interactive mode)\n");
+}
+
+// Load the binary history file and keep appending to it. A CSV history from
+// an older version is imported once, going through the journal so it ends
+// up in the binary file. With a memory limit, older entries are then left
+// in the file and read back from it on demand.
+static void open_history(CalculationHistory *hist, int sync_interval, int memory_limit)
+{
+    FILE *existing = fopen(DEFAULT_HISTORY_FILE, "rb");
+    int migrate = existing == NULL;
+    if (existing != NULL)
+        fclose(existing);
+
+    load_history_from_file(hist, DEFAULT_HISTORY_FILE);
+
+    // From here on, new calculations are appended to the history file as they happen
+    attach_history_journal(hist, DEFAULT_HISTORY_FILE, sync_interval);
+
+    existing = migrate ? fopen(DEFAULT_CSV_FILE, "r") : NULL;
+    if (existing != NULL)
+    {
+        fclose(existing);
+        if (import_history_csv(hist, DEFAULT_CSV_FILE) == HISTORY_SUCCESS)
+            flush_history_journal(hist);
+    }
+
+    if (memory_limit > 0 && set_history_memory_limit(hist, memory_limit) != HISTORY_SUCCESS)
+        print_error("Cannot limit history memory; keeping every entry in memory");
+}
+
+// Non-interactive mode: no prompts, no command dispatch, one buffered write stream
+static int run_batch_mode(const char *filename, int record_history, int sync_interval,
+                          int memory_limit, size_t cache_size, int threads)
+{
+    FILE *in = stdin;
+    if (filename != NULL)
+    {
+        in = fopen(filename, "rb");
+        if (in == NULL)
+        {
+            fprintf(stderr, "Error : Cannot open file '%s' for reading\n", filename);
+            return 1;
+        }
+    }
+
+    CalculationHistory history;
+    ExpressionCache cache;
+    BatchOptions options = {NULL, NULL, threads};
+    if (expression_cache_init(&cache, cache_size))
+        options.cache = &cache;
+    if (record_history)
+    {
+        if (init_history(&history) != HISTORY_SUCCESS)
+        {
+            print_error("Failed to initialize history");
+            if (in != stdin)
+                fclose(in);
+            return 1;
+        }
+        history.verbose = HISTORY_VERBOSE_QUIET; // Keep stdout for results only
+        open_history(&history, sync_interval, memory_limit);
+        options.history = &history;
+    }
+
+    long failures = run_batch(in, stdout, &options);
+    expression_cache_free(&cache);
+
+    if (in != stdin)
+        fclose(in);
+    if (record_history)
+    {
+        cleanup_history(&history); // Flushes the journal
+    }
+    if (failures < 0)
+    {
+        print_error("Batch processing failed");
+        return 1;
+    }
+    return failures > 0 ? 2 : 0;
+}
+
+static volatile sig_atomic_t stop_server = 0;
+
+static void request_server_stop(int signal_number)
+{
+    (void)signal_number;
+    stop_server = 1;
+}
+
+// Server mode: history is loaded once and shared by every client
+static int run_server_mode(const char *socket_path, int sync_interval, int memory_limit,
+                           size_t cache_size)
+{
+    CalculationHistory history;
+    ExpressionCache cache;
+    if (init_history(&history) != HISTORY_SUCCESS)
+    {
+        print_error("Failed to initialize history");
+        return 1;
+    }
+    history.verbose = HISTORY_VERBOSE_QUIET;
+    open_history(&history, sync_interval, memory_limit);
+    expression_cache_init(&cache, cache_size); // A failed cache just stays disabled
+
+    // No SA_RESTART: the signal has to interrupt epoll_wait
+    struct sigaction action = {0};
+    action.sa_handler = request_server_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    ServerOptions options = {&history, &cache, &stop_server};
+    fprintf(stderr, "Serving on %s\n", socket_path);
+    int status = run_server(socket_path, &options);
+
+    expression_cache_free(&cache);
+    cleanup_history(&history); // Flushes the journal
+    return status == 0 ? 0 : 1;
+}
+
 static void display_welcome(void)
 {
     printf("Command -Line Calculator - Part 2\n");
@@ -96,24 +322,52 @@ static void display_help(void)
     printf(" - : Subtraction \n");
     printf(" * : Multiplication \n");
     printf(" / : Division \n");
-    printf(" ^ : Exponentiation \n\n");
+    printf(" ^ : Exponentiation \n");
+    printf(" ( ) : Grouping \n\n");
 
     printf(" History Commands :\n");
     printf(" history : Show calculation history \n");
+    printf(" history N [M] : Show M entries from number N (-N: the last N)\n");
+    printf(" history --since T --until T : Show entries in a time window\n");
     printf(" clear : Clear current session history \n");
-    printf(" save [file] : Save history to file\n");
+    printf(" save [file] : Save history to a binary file (use export for CSV)\n");
     printf(" load [file] : Load history from file\n");
-    printf(" replay N : Replay calculation number N\n\n");
+    printf(" export [file] : Export history as CSV\n");
+    printf(" import [file] : Import history from CSV\n");
+    printf(" search TEXT : Show entries whose expression contains TEXT\n");
+    printf(" find result OP X : Show entries by result (OP is <, <=, =, >=, >)\n");
+    printf(" replay N : Replay calculation number N\n");
+    printf(" replay A..B | replay all : Re-evaluate entries and report changed results\n\n");
 
     printf(" Special Commands :\n");
     printf(" help : Show this help message \n");
+    printf(" stats : Show cache, allocation and timing statistics \n");
     printf(" Q : Save and quit calculator \n\n");
 
-    printf(" Usage: number operator number \n");
-    printf(" Examples : 5 + 3, 10-4, 7*2 , 20/4 , 2^3\n\n");
+    printf(" Usage: expression \n");
+    printf(" Examples : 5 + 3, 10-4, 7*2 , 20/4 , 2^3, (1+2)*-3\n\n");
 }
 
-static int handle_command(CalculationHistory *hist, const char *input)
+// Filename ends in .csv, in any case
+static int has_csv_extension(const char *filename)
+{
+    size_t length = strlen(filename);
+    if (length < 4)
+        return 0;
+    const char *suffix = filename + length - 4;
+    return suffix[0] == '.' && tolower((unsigned char)suffix[1]) == 'c' &&
+           tolower((unsigned char)suffix[2]) == 's' && tolower((unsigned char)suffix[3]) == 'v';
+}
+
+// search and find only see the resident entries; say so when some are not
+static void note_evicted_entries(const CalculationHistory *hist)
+{
+    if (hist->first_resident > 0)
+        printf("(searched the newest %d entries; %d older entries are on disk only)\n",
+               hist->count - hist->first_resident, hist->first_resident);
+}
+
+static int handle_command(CalculationHistory *hist, ExpressionCache *cache, const char *input)
 {
     // Handle help command
     if (strcmp(input, "help") == 0)
@@ -122,12 +376,31 @@ static int handle_command(CalculationHistory *hist, const char *input)
         return 1;
     }
 
+    // Handle stats command
+    if (strcmp(input, "stats") == 0)
+    {
+        unsigned long lookups = cache->hits + cache->misses;
+        printf("Expression cache: %zu / %zu entries\n", cache->count, cache->capacity);
+        printf(" hits: %lu, misses: %lu, evictions: %lu", cache->hits, cache->misses,
+               cache->evictions);
+        if (lookups > 0)
+            printf(" (hit rate %.1f%%)", 100.0 * cache->hits / lookups);
+        printf("\n");
+        instrument_report(stdout);
+        return 1;
+    }
+
     // Handle history command
     if (strcmp(input, "history") == 0)
     {
         display_history(hist);
         return 1;
     }
+    if (strncmp(input, "history ", 8) == 0)
+    {
+        handle_history_view(hist, input + 8);
+        return 1;
+    }
 
     // Handle clear command
     if (strcmp(input, "clear") == 0)
@@ -150,6 +423,13 @@ static int handle_command(CalculationHistory *hist, const char *input)
             filename = input + 5; // Skip "save "
         }
 
+        // save always writes the binary format; CSV goes through export
+        if (has_csv_extension(filename))
+        {
+            printf("Error: save writes the binary format; use 'export %s' for CSV\n", filename);
+            return 1;
+        }
+
         if (save_history_to_file(hist, filename) == HISTORY_SUCCESS)
         {
             printf("History saved to %s (%d entries )\n", filename,
@@ -177,71 +457,319 @@ static int handle_command(CalculationHistory *hist, const char *input)
         return 1;
     }
 
-    // Handle replay command
-    if (strncmp(input, "replay", 6) == 0)
+    // Handle export command
+    if (strncmp(input, "export", 6) == 0)
+    {
+        const char *filename = DEFAULT_CSV_FILE;
+
+        // Check if filename specified
+        if (strlen(input) > 7)
+        {
+            filename = input + 7; // Skip "export "
+        }
+
+        if (export_history_csv(hist, filename) == HISTORY_SUCCESS)
+        {
+            printf("History exported to %s (%d entries )\n", filename,
+                   get_history_count(hist));
+        }
+        else
+        {
+            printf("Error: Unable to export to %s\n", filename);
+        }
+        return 1;
+    }
+
+    // Handle import command
+    if (strncmp(input, "import", 6) == 0)
+    {
+        const char *filename = DEFAULT_CSV_FILE;
+
+        // Check if filename specified
+        if (strlen(input) > 7)
+        {
+            filename = input + 7; // Skip "import "
+        }
+
+        import_history_csv(hist, filename);
+        return 1;
+    }
+
+    // Handle search command
+    if (strncmp(input, "search ", 7) == 0)
     {
+        HistoryMatches matches;
+        history_matches_init(&matches);
+        if (search_history(hist, input + 7, &matches) == HISTORY_SUCCESS)
+        {
+            display_history_matches(hist, &matches, SEARCH_DISPLAY_LIMIT);
+            note_evicted_entries(hist);
+        }
+        else
+            print_error("Search failed");
+        history_matches_free(&matches);
+        return 1;
+    }
 
-        if (!is_valid_number(input + 7))
+    // Handle find command
+    if (strncmp(input, "find", 4) == 0)
+    {
+        char op[3];
+        double value;
+        HistoryMatches matches;
+        if (sscanf(input + 4, " result %2[<>=] %lf", op, &value) != 2)
         {
-            print_error("Error: Usage : replay N ( where N is calculation number )");
+            print_error("Error: Usage : find result OP X ( OP is <, <=, =, >=, > )");
             return 1;
         }
-        int index = atoi(input + 7) - 1; // Convert to 0- based index
-        char result[50];
+        history_matches_init(&matches);
+        if (find_history_by_result(hist, op, value, &matches) == HISTORY_SUCCESS)
+        {
+            display_history_matches(hist, &matches, SEARCH_DISPLAY_LIMIT);
+            note_evicted_entries(hist);
+        }
+        else
+            print_error("Error: Usage : find result OP X ( OP is <, <=, =, >=, > )");
+        history_matches_free(&matches);
+        return 1;
+    }
 
-        HistoryResult res = replay_calculation(hist, index, result);
-        if (res == HISTORY_SUCCESS)
+    // Handle replay command
+    if (strncmp(input, "replay", 6) == 0)
+    {
+        const char *args = input + 7;
+        int count = get_history_count(hist);
+        int first, last;
+        if (strlen(input) > 7 && strcmp(args, "all") == 0)
+        {
+            first = 1;
+            last = count;
+        }
+        else if (strlen(input) > 7 && strstr(args, "..") != NULL)
+        {
+            char tail;
+            if (sscanf(args, "%d..%d%c", &first, &last, &tail) != 2)
+            {
+                print_error(REPLAY_USAGE);
+                return 1;
+            }
+        }
+        else if (strlen(input) > 7 && is_valid_number(args))
         {
-            display_history_entry(hist, index);
-            printf("= %s\n", result);
+            replay_single(hist, atoi(args) - 1); // Convert to 0- based index
+            return 1;
         }
         else
         {
-            printf("Error: Invalid history index . Only %d calculations available.\n",
-                   get_history_count(hist));
+            print_error(REPLAY_USAGE);
+            return 1;
+        }
+
+        if (first < 1 || last > count || first > last)
+        {
+            printf("Error: Invalid history range . Only %d calculations available.\n", count);
+            return 1;
         }
+        replay_range(hist, first - 1, last - first + 1);
         return 1;
     }
 
     return 0; // Not a recognized command
 }
 
-static int handle_expression(CalculationHistory *hist, const char *input)
+// Text for a result as "3" or "ERROR: Division by zero!"
+static const char *describe_result(double result, CalcResult status, char *buffer, size_t size)
+{
+    if (status != CALC_SUCCESS)
+    {
+        snprintf(buffer, size, "ERROR: %s", calc_error_message(status));
+        return buffer;
+    }
+    format_double(result, buffer, size);
+    return buffer;
+}
+
+static void replay_single(const CalculationHistory *hist, int index)
+{
+    double result;
+    CalcResult status;
+    if (replay_calculation(hist, index, &result, &status) != HISTORY_SUCCESS)
+    {
+        printf("Error: Invalid history index . Only %d calculations available.\n",
+               get_history_count(hist));
+        return;
+    }
+
+    char output[CALC_ERROR_MSG_SIZE];
+    display_history_entry(hist, index);
+    printf("= %s\n", describe_result(result, status, output, sizeof(output)));
+
+    const Calculation *calc = history_entry(hist, index);
+    if (calc != NULL &&
+        (status != (CalcResult)calc->status || (status == CALC_SUCCESS && result != calc->result)))
+    {
+        printf("Differs from the stored result %s\n",
+               describe_result(calc->result, (CalcResult)calc->status, output, sizeof(output)));
+    }
+}
+
+// Re-evaluate entries [first, first + count) on all cores and list the
+// entries whose result changed
+static void replay_range(const CalculationHistory *hist, int first, int count)
+{
+    struct timespec start, end;
+    ReplayReport report;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (replay_history(hist, first, count, thread_pool_default_size(), &report) != HISTORY_SUCCESS)
+    {
+        print_error("Replay failed");
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed_ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    printf("Replayed %d calculations in %.1f ms: %d diverged\n", count, elapsed_ms,
+           report.diverged.count);
+    for (int i = 0; i < report.diverged.count && i < REPLAY_DISPLAY_LIMIT; i++)
+    {
+        int index = report.diverged.entries[i];
+        const Calculation *calc = history_entry(hist, index);
+        if (calc == NULL)
+            continue;
+        char stored[CALC_ERROR_MSG_SIZE], now[CALC_ERROR_MSG_SIZE];
+        describe_result(calc->result, (CalcResult)calc->status, stored, sizeof(stored));
+        describe_result(report.results[index - first], (CalcResult)report.statuses[index - first],
+                        now, sizeof(now));
+        printf("[%d] %s : stored %s, now %s\n", index + 1, calc->expression_str, stored, now);
+    }
+    if (report.diverged.count > REPLAY_DISPLAY_LIMIT)
+        printf("... %d more not shown\n", report.diverged.count - REPLAY_DISPLAY_LIMIT);
+    free_replay_report(&report);
+}
+
+// Parse a time as epoch seconds, YYYY-MM-DD or YYYY-MM-DDThh:mm[:ss] (local
+// time). A bare date means the start of that day, or its end if end_of_day.
+static int parse_time_arg(const char *text, int end_of_day, time_t *out)
+{
+    if (is_valid_number(text) && strchr(text, '.') == NULL)
+    {
+        *out = (time_t)atoll(text);
+        return 1;
+    }
+
+    struct tm tm_info = {0};
+    int hour = 0, minute = 0, second = 0;
+    char tail;
+    int fields = sscanf(text, "%d-%d-%dT%d:%d:%d%c", &tm_info.tm_year, &tm_info.tm_mon,
+                        &tm_info.tm_mday, &hour, &minute, &second, &tail);
+    if (fields != 3 && fields != 5 && fields != 6)
+        return 0;
+    if (fields == 3 && end_of_day)
+    {
+        hour = 23;
+        minute = 59;
+        second = 59;
+    }
+    tm_info.tm_year -= 1900;
+    tm_info.tm_mon -= 1;
+    tm_info.tm_hour = hour;
+    tm_info.tm_min = minute;
+    tm_info.tm_sec = second;
+    tm_info.tm_isdst = -1;
+    *out = mktime(&tm_info);
+    return *out != (time_t)-1;
+}
+
+// history OFFSET [LIMIT] pages through entries (a negative OFFSET counts
+// from the end); history --since T [--until T] shows a time window
+static void handle_history_view(const CalculationHistory *hist, const char *args)
+{
+    char copy[BUFFER_SIZE];
+    strncpy(copy, args, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+
+    const char *usage = "Error: Usage : history [OFFSET [LIMIT]] | history [--since T] [--until T]";
+    char *first = strtok(copy, " ");
+    if (first == NULL)
+    {
+        display_history(hist);
+        return;
+    }
+
+    if (strncmp(first, "--", 2) == 0)
+    {
+        time_t since = (time_t)LLONG_MIN;
+        time_t until = (time_t)LLONG_MAX;
+        for (char *option = first; option != NULL; option = strtok(NULL, " "))
+        {
+            char *value = strtok(NULL, " ");
+            int ok = value != NULL;
+            if (ok && strcmp(option, "--since") == 0)
+                ok = parse_time_arg(value, 0, &since);
+            else if (ok && strcmp(option, "--until") == 0)
+                ok = parse_time_arg(value, 1, &until);
+            else
+                ok = 0;
+            if (!ok)
+            {
+                print_error(usage);
+                return;
+            }
+        }
+        int shown = display_history_window(hist, since, until);
+        printf("%d of %d entries in range\n", shown, get_history_count(hist));
+        return;
+    }
+
+    char *second = strtok(NULL, " ");
+    char *sign = first[0] == '-' ? first + 1 : first;
+    if (!is_valid_number(sign) || (second != NULL && !is_valid_number(second)))
+    {
+        print_error(usage);
+        return;
+    }
+    int count = get_history_count(hist);
+    int offset = atoi(first);
+    int limit = second != NULL ? atoi(second) : HISTORY_PAGE_SIZE;
+    // Entries are numbered from 1; -N starts N entries before the end
+    int start = offset < 0 ? count + offset : offset - 1;
+    if (start < 0)
+        start = 0;
+    if (start >= count || limit <= 0)
+    {
+        printf("No entries in that range (%d total)\n", count);
+        return;
+    }
+    if (limit > count - start)
+        limit = count - start;
+    printf("Calculation History (entries %d-%d of %d):\n", start + 1, start + limit, count);
+    display_history_range(hist, start, limit);
+}
+
+static int handle_expression(CalculationHistory *hist, ExpressionCache *cache, const char *input)
 {
     double result;
-    char error_msg[100] = "";
-    CalcResult calc_result = parse_expression(input, &result, error_msg);
+    char error_msg[CALC_ERROR_MSG_SIZE] = "";
+    CalcResult calc_result = cached_parse_expression(cache, input, &result, error_msg);
 
     if (calc_result == CALC_SUCCESS)
     {
-        char output[50];
-        snprintf(output, 50, "%f", result);
+        char output[DOUBLE_STRING_SIZE];
+        format_double(result, output, sizeof(output));
         printf("= %s\n", output);
-        add_calculation(hist, input, output, 0);
+        add_calculation(hist, input, result, CALC_SUCCESS);
     }
     else
     {
-        // Handle different error types
-        switch (calc_result)
+        // Keep the parser's detailed message for invalid input
+        if (calc_result != CALC_INVALID_INPUT || strlen(error_msg) == 0)
         {
-        case CALC_DIVISION_BY_ZERO:
-            strcpy(error_msg, "Division by zero!");
-            break;
-        case CALC_INVALID_INPUT:
-            if (strlen(error_msg) == 0)
-            {
-                strcpy(error_msg, "Invalid input or expression ");
-            }
-            break;
-        case CALC_OVERFLOW:
-            strcpy(error_msg, "Numerical overflow");
-            break;
-        default:
-            strcpy(error_msg, "Unknown calculation error ");
+            strcpy(error_msg, calc_error_message(calc_result));
         }
 
         printf("Error: %s\n", error_msg);
-        add_calculation(hist, input, error_msg, 1);
+        add_calculation(hist, input, 0.0, calc_result);
     }
 
     return 1;
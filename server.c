@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "server.h"
+#include "batch.h"
+#include "utils.h"
+
+// One connected client. Requests are answered as soon as their line is
+// complete, so responses are in request order by construction.
+typedef struct Client
+{
+    struct Client *prev; // Open clients form a list so shutdown can free them
+    struct Client *next;
+    int fd;
+    ByteBuffer input;  // Received bytes not yet forming a complete line
+    ByteBuffer output; // Responses not yet written
+    size_t output_sent;
+    int reading;       // EPOLLIN is enabled
+    int peer_closed;   // Read side saw end of file
+} Client;
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static Client *open_clients = NULL;
+
+static void close_client(int epoll_fd, Client *client)
+{
+    if (client->prev != NULL)
+        client->prev->next = client->next;
+    else
+        open_clients = client->next;
+    if (client->next != NULL)
+        client->next->prev = client->prev;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    byte_buffer_free(&client->input);
+    byte_buffer_free(&client->output);
+    safe_free(client);
+}
+
+// Evaluate every complete line in the input buffer and queue the responses
+static int answer_requests(Client *client, const ServerOptions *options)
+{
+    char *data = (char *)client->input.data;
+    size_t start = 0;
+    char *newline;
+    while ((newline = memchr(data + start, '\n', client->input.length - start)) != NULL)
+    {
+        *newline = '\0';
+        if (!byte_buffer_reserve(&client->output, BATCH_LINE_OUTPUT_SIZE))
+            return 0;
+        int failed;
+        client->output.length += batch_evaluate_line(data + start, newline - (data + start),
+                                                     options->cache, options->history,
+                                                     (char *)client->output.data + client->output.length,
+                                                     &failed);
+        start = newline + 1 - data;
+    }
+
+    // Keep the partial last line for the next read
+    memmove(data, data + start, client->input.length - start);
+    client->input.length -= start;
+    return client->input.length <= SERVER_MAX_LINE;
+}
+
+// Write as much pending output as the socket takes; 0 on a write error
+static int send_responses(Client *client)
+{
+    while (client->output_sent < client->output.length)
+    {
+        ssize_t sent = send(client->fd, client->output.data + client->output_sent,
+                            client->output.length - client->output_sent, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 1;
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        client->output_sent += (size_t)sent;
+    }
+    client->output.length = 0;
+    client->output_sent = 0;
+    return 1;
+}
+
+// Read whatever is available; 0 when the client should be dropped
+static int receive_requests(Client *client, const ServerOptions *options)
+{
+    while (1)
+    {
+        if (!byte_buffer_reserve(&client->input, SERVER_READ_SIZE + 1))
+            return 0;
+        ssize_t got = recv(client->fd, client->input.data + client->input.length, SERVER_READ_SIZE, 0);
+        if (got == 0)
+        {
+            // Answer a final request that has no newline, then finish writing
+            client->peer_closed = 1;
+            if (client->input.length > 0)
+            {
+                client->input.data[client->input.length++] = '\n';
+                if (!answer_requests(client, options))
+                    return 0;
+            }
+            return 1;
+        }
+        if (got < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 1;
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        client->input.length += (size_t)got;
+        if (!answer_requests(client, options))
+            return 0;
+        // Stop reading from a client that does not collect its responses
+        if (client->output.length - client->output_sent > SERVER_MAX_PENDING_OUTPUT)
+            return 1;
+    }
+}
+
+// Wait for input only while the client keeps up with its responses, and for
+// writability only while responses are pending
+static void update_events(int epoll_fd, Client *client)
+{
+    size_t pending = client->output.length - client->output_sent;
+    struct epoll_event event = {0};
+    client->reading = !client->peer_closed && pending <= SERVER_MAX_PENDING_OUTPUT;
+    event.events = (client->reading ? EPOLLIN | EPOLLRDHUP : 0) | (pending > 0 ? EPOLLOUT : 0);
+    event.data.ptr = client;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+}
+
+static void accept_clients(int epoll_fd, int listen_fd)
+{
+    while (1)
+    {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            return; // EAGAIN: no more pending connections
+        Client *client = safe_calloc(1, sizeof(Client));
+        if (client == NULL || !set_nonblocking(fd))
+        {
+            safe_free(client);
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        client->reading = 1;
+        struct epoll_event event = {0};
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.ptr = client;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+            close(fd);
+            safe_free(client);
+            continue;
+        }
+        client->next = open_clients;
+        if (open_clients != NULL)
+            open_clients->prev = client;
+        open_clients = client;
+    }
+}
+
+// Remove the socket file unless something else has taken its place
+static void remove_socket_file(const char *socket_path, const struct stat *created)
+{
+    struct stat current;
+    if (lstat(socket_path, &current) == 0 && S_ISSOCK(current.st_mode) &&
+        current.st_dev == created->st_dev && current.st_ino == created->st_ino)
+    {
+        unlink(socket_path);
+    }
+}
+
+// Bind and listen on socket_path; *created identifies the socket file made
+static int open_listen_socket(const char *socket_path, struct stat *created)
+{
+    struct sockaddr_un address = {0};
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Error : Socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    // Only a stale socket from an earlier run may be replaced
+    struct stat existing;
+    if (lstat(socket_path, &existing) == 0)
+    {
+        if (!S_ISSOCK(existing.st_mode))
+        {
+            fprintf(stderr, "Error : %s exists and is not a socket; not replacing it\n", socket_path);
+            return -1;
+        }
+        unlink(socket_path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        lstat(socket_path, created) != 0)
+    {
+        perror("Error : Cannot listen on socket");
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, SOMAXCONN) != 0 || !set_nonblocking(fd))
+    {
+        perror("Error : Cannot listen on socket");
+        close(fd);
+        remove_socket_file(socket_path, created);
+        return -1;
+    }
+    return fd;
+}
+
+int run_server(const char *socket_path, const ServerOptions *options)
+{
+    struct stat created;
+    int listen_fd = open_listen_socket(socket_path, &created);
+    if (listen_fd < 0)
+        return -1;
+    int epoll_fd = epoll_create1(0);
+    struct epoll_event event = {0};
+    event.events = EPOLLIN;
+    event.data.ptr = NULL; // NULL marks the listening socket
+    if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) != 0)
+    {
+        if (epoll_fd >= 0)
+            close(epoll_fd);
+        close(listen_fd);
+        remove_socket_file(socket_path, &created);
+        return -1;
+    }
+
+    // SIGINT and SIGTERM are only delivered inside epoll_pwait, so one that
+    // arrives after the flag check still interrupts the wait
+    sigset_t stop_signals, wait_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &wait_mask);
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (!*options->stop)
+    {
+        int ready = epoll_pwait(epoll_fd, events, SERVER_MAX_EVENTS, -1, &wait_mask);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+                continue; // Signal: re-check the stop flag
+            break;
+        }
+        for (int i = 0; i < ready; i++)
+        {
+            Client *client = events[i].data.ptr;
+            if (client == NULL)
+            {
+                accept_clients(epoll_fd, listen_fd);
+                continue;
+            }
+
+            int ok = 1;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+                ok = client->reading ? receive_requests(client, options) : 1;
+            if (ok)
+                ok = send_responses(client);
+            if (events[i].events & EPOLLERR)
+                ok = 0;
+
+            int finished = client->peer_closed && client->output.length == client->output_sent;
+            if (!ok || finished)
+                close_client(epoll_fd, client);
+            else
+                update_events(epoll_fd, client);
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &wait_mask, NULL);
+
+    // Connections still open at shutdown are dropped without their pending output
+    while (open_clients != NULL)
+        close_client(epoll_fd, open_clients);
+    close(epoll_fd);
+    close(listen_fd);
+    remove_socket_file(socket_path, &created);
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <signal.h>
+#include "history.h"
+#include "cache.h"
+
+#define SERVER_MAX_EVENTS 64
+#define SERVER_READ_SIZE (64 * 1024)
+#define SERVER_MAX_PENDING_OUTPUT (1 << 20) // Stop reading a client with this much unsent
+#define SERVER_MAX_LINE (1 << 20)           // Longest accepted request line
+
+typedef struct
+{
+    CalculationHistory *history; // Shared by every client, or NULL
+    ExpressionCache *cache;      // Shared result cache, or NULL
+    volatile sig_atomic_t *stop; // Set (e.g. from a signal handler) to shut down
+} ServerOptions;
+
+// Serve newline-delimited expressions on a Unix domain socket until
+// *options->stop is set. SIGINT and SIGTERM are blocked on the calling
+// thread except while it waits for events, so a handler that sets the flag
+// for either always ends the wait. Each client may pipeline any number of requests and
+// gets one response line per request, in request order, in the batch mode
+// format. Returns 0 on a clean shutdown, -1 if the socket cannot be set up.
+int run_server(const char *socket_path, const ServerOptions *options);
+
+#endif // SERVER_H
@@ -1,10 +1,24 @@
 #include "minunit.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <math.h>
 #include "calculator.h"
 #include "history.h"
 #include "utils.h"
+#include "batch.h"
+#include "arena.h"
+#include "cache.h"
+#include "thread_pool.h"
+#include "concurrent_history.h"
+#include "server.h"
+#include "instrument.h"
+#include "allocator.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 int tests_run = 0;
 
@@ -31,9 +45,7 @@ MU_TEST(test_add_calculation_grows_array_correctly)
     {
         char expr[32];
         sprintf(expr, "%d + %d", i, i);
-        char res[32];
-        sprintf(res, "%d", i * 2);
-        mu_assert(add_calculation(&hist, expr, res, 0) == HISTORY_SUCCESS, "add_calculation should succeed ");
+        mu_assert(add_calculation(&hist, expr, i * 2, CALC_SUCCESS) == HISTORY_SUCCESS, "add_calculation should succeed ");
     }
 
     mu_assert(hist.capacity > initial_capacity, " array should have grown");
@@ -67,15 +79,17 @@ MU_TEST(test_file_persistence_roundtrip)
     init_history(&hist2);
 
     // Add test data to first history
-    add_calculation(&hist1, "5 + 3", "8", 0);
-    add_calculation(&hist1, "10 / 0", "Division by zero!", 1);
-    add_calculation(&hist1, "7 * 6", "42", 0);
+    add_calculation(&hist1, "5 + 3", 8, CALC_SUCCESS);
+    add_calculation(&hist1, "10 / 0", 0, CALC_DIVISION_BY_ZERO);
+    add_calculation(&hist1, "7 * 6", 42, CALC_SUCCESS);
+    add_calculation(&hist1, "1 / 3", 1.0 / 3.0, CALC_SUCCESS);
+    add_calculation(&hist1, "0.1 + 0.2", 0.1 + 0.2, CALC_SUCCESS);
 
     // Save to file
-    mu_assert(save_history_to_file(&hist1, "test_history.csv") == HISTORY_SUCCESS, "save should succeed ");
+    mu_assert(save_history_to_file(&hist1, "test_history.dat") == HISTORY_SUCCESS, "save should succeed ");
 
     // Load into second history
-    mu_assert(load_history_from_file(&hist2, "test_history.csv") == HISTORY_SUCCESS, "load should succeed ");
+    mu_assert(load_history_from_file(&hist2, "test_history.dat") == HISTORY_SUCCESS, "load should succeed ");
 
     // Verify data matches
     mu_assert(hist1.count == hist2.count, " loaded count should match saved count ");
@@ -85,13 +99,217 @@ MU_TEST(test_file_persistence_roundtrip)
         mu_assert(strcmp(hist1.calculations[i].expression_str,
                          hist2.calculations[i].expression_str) == 0,
                   "expressions should match");
-        mu_assert(strcmp(hist1.calculations[i].result, hist2.calculations[i].result) == 0, " results should match ");
-        mu_assert(hist1.calculations[i].is_error == hist2.calculations[i].is_error, " error flags should match ");
+        mu_assert(hist1.calculations[i].result == hist2.calculations[i].result, " results should round-trip exactly ");
+        mu_assert(hist1.calculations[i].status == hist2.calculations[i].status, " error codes should match ");
     }
 
     cleanup_history(&hist1);
     cleanup_history(&hist2);
-    remove("test_history.csv"); // Clean up test file
+    remove("test_history.dat"); // Clean up test file
+}
+
+// Test array kernels against the scalar operations, including tail elements
+MU_TEST(test_batch_arithmetic_kernels)
+{
+    enum { N = 11 };
+    double a[N], b[N], out[N];
+    double exponents[N];
+    for (int i = 0; i < N; i++)
+    {
+        a[i] = i + 1.5;
+        b[i] = (i % 4 == 0) ? 0.0 : i - 2.5; // Zero divisors at 0, 4 and 8
+        exponents[i] = (i == 6) ? 0.5 : (i == 10) ? 1000.0 : (i % 5) - 1.0;
+    }
+
+    add_n(a, b, out, N);
+    for (int i = 0; i < N; i++)
+        mu_assert_double_eq(add(a[i], b[i]), out[i]);
+    subtract_n(a, b, out, N);
+    for (int i = 0; i < N; i++)
+        mu_assert_double_eq(subtract(a[i], b[i]), out[i]);
+    multiply_n(a, b, out, N);
+    for (int i = 0; i < N; i++)
+        mu_assert_double_eq(multiply(a[i], b[i]), out[i]);
+
+    mu_assert(divide_n(a, b, out, N) == 3, "divide_n should count zero divisors");
+    for (int i = 0; i < N; i++)
+    {
+        CalcResult err;
+        mu_assert_double_eq(divide(a[i], b[i], &err), out[i]);
+    }
+
+    a[1] = NAN; // Exponent 0: still an error, as in power()
+    mu_assert(power_n(a, exponents, out, N) == 2, "power_n should count NaN bases and overflowing lanes");
+    for (int i = 0; i < N; i++)
+    {
+        CalcResult err;
+        mu_assert_double_eq(power(a[i], exponents[i], &err), out[i]);
+    }
+}
+
+// Loader handles long lines, commas inside quotes, CRLF and a missing final newline
+MU_TEST(test_load_history_scans_csv_in_place)
+{
+    FILE *file = fopen("test_history_scan.csv", "w");
+    mu_assert(file != NULL, "should create test file");
+    fprintf(file, "Timestamp ,Expression ,Result ,Error \r\n");
+    fprintf(file, "100,\"1 + 2\",\"3\",0\r\n");
+    fprintf(file, "200,\"");
+    for (int i = 0; i < 300; i++)
+        fprintf(file, "1 + ");
+    fprintf(file, "1\",\"301\",0\n");
+    fprintf(file, "\n");
+    fprintf(file, "300,\"f(1, 2)\",\"say \"\"hi\"\", ok\",1\n");
+    fprintf(file, "400,\"1/0\",\"Division by zero!\",1");
+    fclose(file);
+
+    CalculationHistory hist;
+    init_history(&hist);
+    hist.verbose = 0;
+    mu_assert(import_history_csv(&hist, "test_history_scan.csv") == HISTORY_SUCCESS, "load should succeed");
+    mu_assert_int_eq(4, hist.count);
+    mu_assert_string_eq("1 + 2", hist.calculations[0].expression_str);
+    mu_assert(hist.calculations[0].timestamp == 100, "timestamp should be preserved");
+    mu_assert_int_eq(1201, (int)strlen(hist.calculations[1].expression_str));
+    mu_assert_double_eq(301.0, hist.calculations[1].result);
+    mu_assert_string_eq("f(1, 2)", hist.calculations[2].expression_str);
+    mu_assert_int_eq(CALC_INVALID_INPUT, hist.calculations[2].status);
+    mu_assert_int_eq(CALC_DIVISION_BY_ZERO, hist.calculations[3].status);
+
+    cleanup_history(&hist);
+    remove("test_history_scan.csv");
+}
+
+// Journal appends each new entry; clear compacts the file
+MU_TEST(test_history_journal_appends_and_compacts)
+{
+    remove("test_history_journal.dat");
+    CalculationHistory hist, loaded;
+    init_history(&hist);
+    hist.verbose = 0;
+    add_calculation(&hist, "1 + 1", 2, CALC_SUCCESS); // Before attaching: not journaled
+
+    mu_assert(attach_history_journal(&hist, "test_history_journal.dat", 2) == HISTORY_SUCCESS, "attach should succeed");
+    add_calculation(&hist, "2 + 2", 4, CALC_SUCCESS);
+    add_calculation(&hist, "3 + 3", 6, CALC_SUCCESS); // Reaches the sync interval
+    add_calculation(&hist, "4 / 0", 0, CALC_DIVISION_BY_ZERO);
+    mu_assert(flush_history_journal(&hist) == HISTORY_SUCCESS, "flush should succeed");
+    mu_assert(load_history_from_file(&hist, "test_history_journal.dat") == HISTORY_FILE_ERROR,
+              "loading the journal into its own history should be refused");
+    mu_assert_int_eq(4, hist.count);
+
+    init_history(&loaded);
+    loaded.verbose = 0;
+    load_history_from_file(&loaded, "test_history_journal.dat");
+    mu_assert_int_eq(3, loaded.count);
+    mu_assert_string_eq("2 + 2", loaded.calculations[0].expression_str);
+    mu_assert_int_eq(CALC_DIVISION_BY_ZERO, loaded.calculations[2].status);
+    cleanup_history(&loaded);
+
+    mu_assert(clear_history(&hist) == HISTORY_SUCCESS, "clear should succeed");
+    add_calculation(&hist, "5 + 5", 10, CALC_SUCCESS);
+    cleanup_history(&hist); // Detaches and flushes
+
+    init_history(&loaded);
+    loaded.verbose = 0;
+    load_history_from_file(&loaded, "test_history_journal.dat");
+    mu_assert_int_eq(1, loaded.count);
+    mu_assert_string_eq("5 + 5", loaded.calculations[0].expression_str);
+    cleanup_history(&loaded);
+    remove("test_history_journal.dat");
+}
+
+// CSV export escapes quotes and commas and imports back unchanged
+MU_TEST(test_history_csv_export_import)
+{
+    CalculationHistory hist, imported;
+    init_history(&hist);
+    hist.verbose = 0;
+    add_calculation(&hist, "f(1, \"x\")", 0, CALC_INVALID_INPUT);
+    add_calculation(&hist, "0.1 + 0.2", 0.1 + 0.2, CALC_SUCCESS);
+    mu_assert(export_history_csv(&hist, "test_history_export.csv") == HISTORY_SUCCESS, "export should succeed");
+
+    init_history(&imported);
+    imported.verbose = 0;
+    mu_assert(import_history_csv(&imported, "test_history_export.csv") == HISTORY_SUCCESS, "import should succeed");
+    mu_assert_int_eq(2, imported.count);
+    mu_assert_string_eq("f(1, \"x\")", imported.calculations[0].expression_str);
+    mu_assert_int_eq(CALC_INVALID_INPUT, imported.calculations[0].status);
+    mu_assert(imported.calculations[1].result == 0.1 + 0.2, "result should round-trip exactly");
+
+    cleanup_history(&hist);
+    cleanup_history(&imported);
+    remove("test_history_export.csv");
+}
+
+// A damaged block is detected; the blocks before it still load
+MU_TEST(test_history_binary_detects_corruption)
+{
+    remove("test_history_corrupt.dat");
+    CalculationHistory hist, loaded;
+    init_history(&hist);
+    hist.verbose = 0;
+    mu_assert(attach_history_journal(&hist, "test_history_corrupt.dat", 1) == HISTORY_SUCCESS, "attach should succeed");
+    add_calculation(&hist, "1 + 1", 2, CALC_SUCCESS); // One block per record
+    add_calculation(&hist, "2 + 2", 4, CALC_SUCCESS);
+    cleanup_history(&hist);
+
+    FILE *file = fopen("test_history_corrupt.dat", "r+b");
+    mu_assert(file != NULL, "should open history file");
+    fseek(file, -1, SEEK_END); // Last byte of the second record's expression
+    fputc('3', file);
+    fclose(file);
+
+    init_history(&loaded);
+    loaded.verbose = 0;
+    mu_assert(load_history_from_file(&loaded, "test_history_corrupt.dat") == HISTORY_FILE_ERROR, "corruption should be reported");
+    mu_assert_int_eq(1, loaded.count);
+    mu_assert_string_eq("1 + 1", loaded.calculations[0].expression_str);
+
+    // Attaching drops the damaged block, so new appends load again
+    mu_assert(attach_history_journal(&loaded, "test_history_corrupt.dat", 1) == HISTORY_SUCCESS, "attach should succeed");
+    add_calculation(&loaded, "3 + 3", 6, CALC_SUCCESS);
+    cleanup_history(&loaded);
+    init_history(&loaded);
+    loaded.verbose = 0;
+    mu_assert(load_history_from_file(&loaded, "test_history_corrupt.dat") == HISTORY_SUCCESS, "repaired file should load");
+    mu_assert_int_eq(2, loaded.count);
+    mu_assert_string_eq("3 + 3", loaded.calculations[1].expression_str);
+    cleanup_history(&loaded);
+    remove("test_history_corrupt.dat");
+}
+
+// Arena strings stay valid as chunks fill; reset keeps a single chunk
+MU_TEST(test_string_arena_chunks)
+{
+    StringArena arena;
+    arena_init(&arena, 64);
+
+    char *first = arena_strndup(&arena, "hello world", 5);
+    mu_assert_string_eq("hello", first);
+    mu_assert(arena.chunk_count == 1, "first allocation should create one chunk");
+
+    char *strings[20];
+    for (int i = 0; i < 20; i++)
+    {
+        strings[i] = arena_strndup(&arena, "0123456789", 10);
+        mu_assert(strings[i] != NULL, "allocation should succeed");
+    }
+    mu_assert(arena.chunk_count > 1, "arena should have grown by chunks");
+    mu_assert_string_eq("hello", first);
+    mu_assert_string_eq("0123456789", strings[0]);
+
+    char big[200];
+    memset(big, 'x', sizeof(big));
+    char *large = arena_strndup(&arena, big, sizeof(big));
+    mu_assert(large != NULL && strlen(large) == sizeof(big), "oversized strings should get their own chunk");
+
+    arena_reset(&arena);
+    mu_assert(arena.chunk_count == 1, "reset should keep one chunk");
+    mu_assert_string_eq("again", arena_strndup(&arena, "again", 5));
+
+    arena_free(&arena);
+    mu_assert(arena.chunk_count == 0 && arena.head == NULL, "free should release every chunk");
 }
 
 // Test power function behavior
@@ -108,6 +326,32 @@ MU_TEST(test_power_function)
     p = power(5.0, 0, &err);
     mu_assert(err == CALC_SUCCESS, "power with exponent 0 should succeed");
     mu_assert_double_eq(1.0, p);
+
+    // Negative exponents are reciprocals
+    p = power(2.0, -3, &err);
+    mu_assert(err == CALC_SUCCESS, "power should accept negative exponents");
+    mu_assert_double_eq(0.125, p);
+
+    // Fractional exponents are not truncated
+    p = power(9.0, 0.5, &err);
+    mu_assert(err == CALC_SUCCESS, "power should accept fractional exponents");
+    mu_assert_double_eq(3.0, p);
+
+    power(-8.0, 0.5, &err);
+    mu_assert(err == CALC_INVALID_INPUT, "negative base with fractional exponent is invalid");
+
+    // An infinite base goes to zero without underflowing
+    p = power(INFINITY, -1, &err);
+    mu_assert(err == CALC_SUCCESS, "inf ^ -1 should be exact");
+    mu_assert_double_eq(0.0, p);
+    power(0.0, -1, &err);
+    mu_assert(err == CALC_DIVISION_BY_ZERO, "zero to a negative power divides by zero");
+    power(10.0, 400, &err);
+    mu_assert(err == CALC_OVERFLOW, "10^400 should overflow");
+    power(10.0, -400, &err);
+    mu_assert(err == CALC_OVERFLOW, "10^-400 should underflow");
+    p = power(1e160, -2, &err);
+    mu_assert(err == CALC_SUCCESS && p > 0.0, "subnormal results should still be returned");
 }
 
 // Test expression parsing
@@ -131,6 +375,98 @@ MU_TEST(test_parse_expression_valid_and_invalid)
     mu_assert(r == CALC_INVALID_INPUT, "parse_expression should return CALC_INVALID_INPUT for bad input");
 }
 
+// Test operator precedence, associativity and parentheses
+MU_TEST(test_parse_expression_precedence)
+{
+    double out = 0.0;
+    char err_msg[128] = {0};
+
+    mu_assert(parse_expression("2+3*4", &out, err_msg) == CALC_SUCCESS, "parse should handle mixed precedence");
+    mu_assert_double_eq(14.0, out);
+    mu_assert(parse_expression("(2 + 3) * 4", &out, err_msg) == CALC_SUCCESS, "parse should handle parentheses");
+    mu_assert_double_eq(20.0, out);
+    mu_assert(parse_expression("2^3^2", &out, err_msg) == CALC_SUCCESS, "parse should handle chained powers");
+    mu_assert_double_eq(512.0, out);
+    mu_assert(parse_expression("-2^2", &out, err_msg) == CALC_SUCCESS, "parse should handle unary minus before power");
+    mu_assert_double_eq(-4.0, out);
+    mu_assert(parse_expression("10 - 4 - 3", &out, err_msg) == CALC_SUCCESS, "parse should be left-associative");
+    mu_assert_double_eq(3.0, out);
+    mu_assert(parse_expression("-(3 - 5) * --2", &out, err_msg) == CALC_SUCCESS, "parse should handle nested signs");
+    mu_assert_double_eq(4.0, out);
+
+    mu_assert(parse_expression("2 * (3 + 1", &out, err_msg) == CALC_INVALID_INPUT, "missing ')' should be rejected");
+    mu_assert(parse_expression("2 + 3)", &out, err_msg) == CALC_INVALID_INPUT, "unmatched ')' should be rejected");
+    mu_assert(parse_expression("1 +", &out, err_msg) == CALC_INVALID_INPUT, "dangling operator should be rejected");
+    mu_assert(parse_expression("1.2.3", &out, err_msg) == CALC_INVALID_INPUT, "malformed number should be rejected");
+    mu_assert(parse_expression("4 / (2 - 2)", &out, err_msg) == CALC_DIVISION_BY_ZERO, "nested division by zero should be reported");
+}
+
+// Test compiling once and evaluating the bytecode repeatedly
+MU_TEST(test_compile_and_evaluate_expression)
+{
+    CompiledExpression expr;
+    double out = 0.0;
+    char err_msg[128] = {0};
+
+    mu_assert(compile_expression("(1 + 2) * -3 ^ 2", &expr, err_msg) == CALC_SUCCESS, "compile should succeed");
+    mu_assert(expr.constant_count == 4, "each literal should land in the constant pool");
+    mu_assert(expr.max_stack >= 2 && expr.max_stack <= MAX_EVAL_STACK, "stack depth should be tracked");
+    for (int i = 0; i < 3; i++)
+    {
+        mu_assert(evaluate_expression(&expr, &out) == CALC_SUCCESS, "evaluate should succeed repeatedly");
+        mu_assert_double_eq(-27.0, out);
+    }
+
+    mu_assert(compile_expression("1 / (3 - 3)", &expr, err_msg) == CALC_SUCCESS, "division by zero is a runtime error");
+    mu_assert(evaluate_expression(&expr, &out) == CALC_DIVISION_BY_ZERO, "evaluate should report division by zero");
+
+    mu_assert(compile_expression("2 +* 3", &expr, err_msg) == CALC_INVALID_INPUT, "compile should reject bad syntax");
+}
+
+// Test named variables and columnar batch evaluation
+MU_TEST(test_variables_and_batch_evaluation)
+{
+    CompiledExpression expr;
+    char err_msg[128] = {0};
+    double out = 0.0;
+
+    mu_assert(compile_expression("a*x^2 + b / x", &expr, err_msg) == CALC_SUCCESS, "compile with variables should succeed");
+    mu_assert(expr.variable_count == 3, "a, x and b should each get one slot");
+    int ia = find_expression_variable(&expr, "a");
+    int ix = find_expression_variable(&expr, "x");
+    int ib = find_expression_variable(&expr, "b");
+    mu_assert(ia >= 0 && ix >= 0 && ib >= 0, "all variables should be found");
+    mu_assert(find_expression_variable(&expr, "y") == -1, "unused variable should not be found");
+
+    double values[3];
+    values[ia] = 2.0;
+    values[ix] = 3.0;
+    values[ib] = 6.0;
+    mu_assert(evaluate_expression_with(&expr, values, &out) == CALC_SUCCESS, "bound evaluation should succeed");
+    mu_assert_double_eq(20.0, out);
+    mu_assert(evaluate_expression(&expr, &out) == CALC_INVALID_INPUT, "unbound variables should be rejected");
+
+    // Enough rows to span several evaluation blocks plus a partial one
+    enum { ROWS = 200 };
+    double a[ROWS], x[ROWS], b[ROWS], results[ROWS];
+    for (int i = 0; i < ROWS; i++)
+    {
+        a[i] = 1.0;
+        x[i] = (double)i;
+        b[i] = 2.0;
+    }
+    const double *columns[3];
+    columns[ia] = a;
+    columns[ix] = x;
+    columns[ib] = b;
+    mu_assert(evaluate_expression_batch(&expr, columns, ROWS, results) == 1, "only the x == 0 row should fail");
+    mu_assert(isnan(results[0]), "failed row should be NAN");
+    mu_assert_double_eq(3.0, results[1]);
+    mu_assert_double_eq(199.0 * 199.0 + 2.0 / 199.0, results[199]);
+
+    mu_assert(parse_expression("x + 1", &out, err_msg) == CALC_INVALID_INPUT, "parse_expression has no bindings");
+}
+
 // Test validation helpers for numbers and operators
 MU_TEST(test_validation_helpers)
 {
@@ -152,13 +488,15 @@ MU_TEST(test_history_clear_and_replay)
     init_history(&hist);
 
     // Add a single calculation and ensure count increments
-    mu_assert(add_calculation(&hist, "2 + 2", "4", 0) == HISTORY_SUCCESS, "add_calculation should succeed");
+    mu_assert(add_calculation(&hist, "2 + 2", 4, CALC_SUCCESS) == HISTORY_SUCCESS, "add_calculation should succeed");
     mu_assert(get_history_count(&hist) == 1, "history count should be 1 after addition");
 
-    // Replay the calculation and verify the returned result string
-    char replay_result[128] = {0};
-    mu_assert(replay_calculation(&hist, 0, replay_result) == HISTORY_SUCCESS, "replay_calculation should succeed for valid index");
-    mu_assert_string_eq("4", replay_result);
+    // Replay the calculation and verify the returned result
+    double replay_result = 0.0;
+    CalcResult replay_status;
+    mu_assert(replay_calculation(&hist, 0, &replay_result, &replay_status) == HISTORY_SUCCESS, "replay_calculation should succeed for valid index");
+    mu_assert(replay_status == CALC_SUCCESS, "replayed entry should be a success");
+    mu_assert_double_eq(4.0, replay_result);
 
     // Clear history and ensure count is zero
     mu_assert(clear_history(&hist) == HISTORY_SUCCESS, "clear_history should succeed");
@@ -167,6 +505,469 @@ MU_TEST(test_history_clear_and_replay)
     cleanup_history(&hist);
 }
 
+// Batch mode: one output line per input line, including a final unterminated one
+MU_TEST(test_run_batch_streams_results)
+{
+    FILE *in = tmpfile();
+    FILE *out = tmpfile();
+    mu_assert(in != NULL && out != NULL, "tmpfile should succeed");
+    fputs("1 + 2\r\n2 * (3 + 4)\n\n5 / 0\n0.5 ^ 2", in);
+    rewind(in);
+
+    CalculationHistory hist;
+    init_history(&hist);
+    hist.verbose = 0;
+    BatchOptions options = {&hist, NULL, 1};
+    mu_assert(run_batch(in, out, &options) == 2, "empty line and division by zero should fail");
+
+    char expected[] = "3\n14\nERROR: Empty input\nERROR: Division by zero!\n0.25\n";
+    char actual[128] = {0};
+    rewind(out);
+    size_t got = fread(actual, 1, sizeof(actual) - 1, out);
+    mu_assert(got == strlen(expected), "output length should match");
+    mu_assert_string_eq(expected, actual);
+    mu_assert(get_history_count(&hist) == 4, "non-empty lines should be recorded");
+
+    fclose(in);
+    fclose(out);
+    cleanup_history(&hist);
+}
+
+// Running tasks on several threads: every task runs exactly once
+static void count_task(void *context, size_t task, int worker)
+{
+    (void)worker;
+    __atomic_fetch_add(&((int *)context)[task], 1, __ATOMIC_RELAXED);
+}
+
+MU_TEST(test_thread_pool_runs_every_task_once)
+{
+    ThreadPool *pool = thread_pool_create(4);
+    mu_assert(pool != NULL, "pool should start");
+    static int counts[10007];
+    for (int round = 0; round < 3; round++) // The pool is reused between runs
+        thread_pool_run(pool, 10007, count_task, counts);
+    thread_pool_destroy(pool);
+    int wrong = 0;
+    for (int i = 0; i < 10007; i++)
+        wrong += counts[i] != 3;
+    mu_assert_int_eq(0, wrong);
+}
+
+// Appenders on every worker while a reader checks the published prefix
+typedef struct
+{
+    ConcurrentHistory *hist;
+    int torn; // Published entries seen incomplete
+} ConcurrentTest;
+
+static void append_and_read_task(void *context, size_t task, int worker)
+{
+    (void)worker;
+    ConcurrentTest *test = context;
+    char expr[32];
+    snprintf(expr, sizeof(expr), "%zu + 1", task);
+    concurrent_history_append(test->hist, expr, task + 1.0, CALC_SUCCESS);
+
+    // Everything published must be complete and self-consistent; the count
+    // may still be 0 while an earlier slot is being written
+    int count = concurrent_history_count(test->hist);
+    const Calculation *calc = count > 0 ? concurrent_history_get(test->hist, count - 1) : NULL;
+    if (count > 0 && (calc == NULL || atoi(calc->expression_str) + 1.0 != calc->result))
+        __atomic_fetch_add(&test->torn, 1, __ATOMIC_RELAXED);
+}
+
+MU_TEST(test_concurrent_history_appends)
+{
+    ConcurrentHistory hist;
+    concurrent_history_init(&hist);
+    ConcurrentTest test = {&hist, 0};
+    ThreadPool *pool = thread_pool_create(4);
+    thread_pool_run(pool, 20000, append_and_read_task, &test);
+    thread_pool_destroy(pool);
+
+    mu_assert_int_eq(0, test.torn);
+    mu_assert_int_eq(20000, concurrent_history_count(&hist));
+    static char seen[20000];
+    int duplicates = 0;
+    for (int i = 0; i < 20000; i++)
+    {
+        const Calculation *calc = concurrent_history_get(&hist, i);
+        duplicates += seen[atoi(calc->expression_str)]++ != 0;
+    }
+    mu_assert_int_eq(0, duplicates); // Every task got its own slot
+    mu_assert(concurrent_history_get(&hist, 20000) == NULL, "unpublished index should be rejected");
+
+    double result;
+    mu_assert_int_eq(CALC_SUCCESS, replay_concurrent_calculation(&hist, 0, &result));
+    mu_assert_double_eq(concurrent_history_get(&hist, 0)->result, result);
+    concurrent_history_free(&hist);
+}
+
+// Server thread for the socket tests, stopped with SIGTERM like the app
+typedef struct
+{
+    ServerOptions options;
+    int status;
+} ServerThread;
+
+static volatile sig_atomic_t test_server_stop = 0;
+
+static void request_test_server_stop(int signal_number)
+{
+    (void)signal_number;
+    test_server_stop = 1;
+}
+
+static void *serve_thread(void *arg)
+{
+    ServerThread *server = arg;
+    server->status = run_server("test_server.sock", &server->options);
+    return NULL;
+}
+
+static void start_test_server(ServerThread *server, pthread_t *thread)
+{
+    test_server_stop = 0;
+    signal(SIGTERM, request_test_server_stop);
+    pthread_create(thread, NULL, serve_thread, server);
+}
+
+static void stop_test_server(pthread_t thread)
+{
+    pthread_kill(thread, SIGTERM);
+    pthread_join(thread, NULL);
+    signal(SIGTERM, SIG_DFL);
+}
+
+static int connect_test_socket(void)
+{
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, "test_server.sock");
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    for (int attempt = 0; attempt < 100; attempt++)
+    {
+        if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0)
+            return fd;
+        nanosleep(&(struct timespec){0, 10000000}, NULL); // Server still starting
+    }
+    close(fd);
+    return -1;
+}
+
+// Pipelined requests from two clients come back in order and share one history
+MU_TEST(test_server_pipelines_requests)
+{
+    CalculationHistory hist;
+    init_history(&hist);
+    hist.verbose = 0;
+    ServerThread server = {{&hist, NULL, &test_server_stop}, -1};
+    pthread_t thread;
+    start_test_server(&server, &thread);
+
+    int first = connect_test_socket();
+    int second = connect_test_socket();
+    mu_assert(first >= 0 && second >= 0, "clients should connect");
+    const char *requests = "1 + 2\n3 / 0\n2 ^ 10\n";
+    write(first, requests, strlen(requests));
+    write(second, "4 * 4", 5);
+    shutdown(first, SHUT_WR);
+    shutdown(second, SHUT_WR); // Unterminated last line still gets an answer
+
+    char response[128];
+    size_t got = 0;
+    ssize_t n;
+    while ((n = read(first, response + got, sizeof(response) - 1 - got)) > 0)
+        got += (size_t)n;
+    response[got] = '\0';
+    mu_assert_string_eq("3\nERROR: Division by zero!\n1024\n", response);
+    got = 0;
+    while ((n = read(second, response + got, sizeof(response) - 1 - got)) > 0)
+        got += (size_t)n;
+    response[got] = '\0';
+    mu_assert_string_eq("16\n", response);
+    close(first);
+    close(second);
+
+    stop_test_server(thread);
+    mu_assert_int_eq(0, server.status);
+    mu_assert_int_eq(4, hist.count);
+    mu_assert(access("test_server.sock", F_OK) != 0, "socket file should be removed");
+    cleanup_history(&hist);
+
+    FILE *file = fopen("test_not_a_socket", "w");
+    fclose(file);
+    mu_assert_int_eq(-1, run_server("test_not_a_socket", &server.options));
+    mu_assert(access("test_not_a_socket", F_OK) == 0, "a regular file should not be replaced");
+    remove("test_not_a_socket");
+}
+
+// calc_client forwards a piped stdin and prints every response (needs the
+// client binary, which `make test` builds)
+MU_TEST(test_client_pipes_stdin)
+{
+    mu_assert(access("./calc_client", X_OK) == 0, "calc_client should be built (make client)");
+    ServerThread server = {{NULL, NULL, &test_server_stop}, -1};
+    pthread_t thread;
+    start_test_server(&server, &thread);
+    close(connect_test_socket()); // Wait until the server listens
+
+    FILE *client = popen("printf '1 + 2\\n3 / 0\\n' | ./calc_client test_server.sock", "r");
+    mu_assert(client != NULL, "popen should succeed");
+    char response[128];
+    size_t got = fread(response, 1, sizeof(response) - 1, client);
+    response[got] = '\0';
+    int status = pclose(client);
+    mu_assert_string_eq("3\nERROR: Division by zero!\n", response);
+    mu_assert_int_eq(0, status);
+    stop_test_server(thread);
+}
+
+// Parallel batch output matches the single-threaded output line for line
+MU_TEST(test_run_batch_parallel_matches_serial)
+{
+    FILE *in = tmpfile();
+    mu_assert(in != NULL, "tmpfile should succeed");
+    for (int i = 0; i < 5000; i++)
+    {
+        if (i % 97 == 0)
+            fprintf(in, "%d / 0\n", i);
+        else if (i % 101 == 0)
+            fprintf(in, "%d +\n", i);
+        else
+            fprintf(in, "%d * 3 - 0.5\n", i % 300);
+    }
+
+    char *outputs[2];
+    long failures[2];
+    int counts[2];
+    for (int run = 0; run < 2; run++)
+    {
+        FILE *out = tmpfile();
+        CalculationHistory hist;
+        ExpressionCache cache;
+        init_history(&hist);
+        hist.verbose = 0;
+        expression_cache_init(&cache, 64);
+        BatchOptions options = {&hist, &cache, run == 0 ? 1 : 4};
+        rewind(in);
+        failures[run] = run_batch(in, out, &options);
+        counts[run] = hist.count;
+        mu_assert_string_eq("1 * 3 - 0.5", hist.calculations[1].expression_str);
+
+        long size = ftell(out);
+        outputs[run] = malloc(size + 1);
+        rewind(out);
+        outputs[run][fread(outputs[run], 1, size, out)] = '\0';
+        fclose(out);
+        expression_cache_free(&cache);
+        cleanup_history(&hist);
+    }
+    fclose(in);
+
+    mu_assert(failures[0] == failures[1] && failures[0] == 52 + 49, "failure counts should match");
+    mu_assert_int_eq(counts[0], counts[1]);
+    mu_assert(strcmp(outputs[0], outputs[1]) == 0, "outputs should match");
+    free(outputs[0]);
+    free(outputs[1]);
+}
+
+// Shortest round-trip formatting
+MU_TEST(test_format_double_round_trips)
+{
+    char buffer[DOUBLE_STRING_SIZE];
+    format_double(8.0, buffer, sizeof(buffer));
+    mu_assert_string_eq("8", buffer);
+    format_double(0.1, buffer, sizeof(buffer));
+    mu_assert_string_eq("0.1", buffer);
+    format_double(0.1 + 0.2, buffer, sizeof(buffer));
+    mu_assert_string_eq("0.30000000000000004", buffer);
+    format_double(-1.5e-300, buffer, sizeof(buffer));
+    mu_assert_string_eq("-1.5e-300", buffer);
+
+    double values[] = {1.0 / 3.0, 2.0 / 3.0, 1e23, 5e-324, 1.7976931348623157e308, 123456.789};
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        double parsed;
+        format_double(values[i], buffer, sizeof(buffer));
+        mu_assert(string_to_double(buffer, &parsed) && parsed == values[i], "formatted value should round-trip");
+    }
+}
+
+// Cache keys ignore insignificant whitespace; CLOCK spares referenced entries
+MU_TEST(test_expression_cache_hits_and_evicts)
+{
+    char key[CACHE_KEY_SIZE];
+    mu_assert(expression_cache_key(" 1 +\t2 ", key), "spaced expression should be cacheable");
+    mu_assert_string_eq("1+2", key);
+    mu_assert(!expression_cache_key("1 2", key), "space inside a number is significant");
+
+    ExpressionCache cache;
+    mu_assert(expression_cache_init(&cache, 2), "init should succeed");
+    double result;
+    char error_msg[CALC_ERROR_MSG_SIZE] = "";
+    mu_assert_int_eq(CALC_SUCCESS, cached_parse_expression(&cache, "1 + 2", &result, error_msg));
+    mu_assert_int_eq(CALC_SUCCESS, cached_parse_expression(&cache, "1+2", &result, error_msg));
+    mu_assert_double_eq(3.0, result);
+    mu_assert(cache.hits == 1 && cache.misses == 1, "second spelling should hit");
+
+    mu_assert_int_eq(CALC_DIVISION_BY_ZERO, cached_parse_expression(&cache, "1/0", &result, error_msg));
+    mu_assert_int_eq(CALC_DIVISION_BY_ZERO, cached_parse_expression(&cache, "1 / 0", &result, error_msg));
+    mu_assert_string_eq("Division by zero!", error_msg);
+    mu_assert_int_eq(CALC_INVALID_INPUT, cached_parse_expression(&cache, "1 2", &result, error_msg));
+
+    // Every entry is referenced: the hand clears both bits and evicts the oldest
+    cached_parse_expression(&cache, "2*3", &result, error_msg);
+    mu_assert(cache.evictions == 1 && cache.count == 2, "full cache should evict one entry");
+    CalcResult status;
+    mu_assert(!expression_cache_lookup(&cache, "1+2", &result, &status), "oldest entry should be evicted");
+
+    // "1/0" is referenced again, so the unreferenced "2*3" goes next
+    mu_assert(expression_cache_lookup(&cache, "1/0", &result, &status), "division entry should be cached");
+    cached_parse_expression(&cache, "4*5", &result, error_msg);
+    mu_assert(expression_cache_lookup(&cache, "1/0", &result, &status), "referenced entry should survive");
+    mu_assert(!expression_cache_lookup(&cache, "2*3", &result, &status), "unreferenced entry should be evicted");
+    expression_cache_free(&cache);
+}
+
+// Indexed search agrees with a scan; result ranges come back in value order
+MU_TEST(test_history_search_and_find)
+{
+    CalculationHistory hist;
+    init_history(&hist);
+    hist.verbose = 0;
+    char expr[32];
+    for (int i = 0; i < 5000; i++)
+    {
+        snprintf(expr, sizeof(expr), "%d * 2", i);
+        add_calculation(&hist, expr, i * 2.0, CALC_SUCCESS);
+    }
+    add_calculation(&hist, "123 / 0", 0, CALC_DIVISION_BY_ZERO);
+
+    HistoryMatches matches;
+    history_matches_init(&matches);
+    mu_assert(search_history(&hist, "123", &matches) == HISTORY_SUCCESS, "search should succeed");
+    int expected = 0;
+    for (int i = 0; i < hist.count; i++)
+        expected += strstr(hist.calculations[i].expression_str, "123") != NULL;
+    mu_assert_int_eq(expected, matches.count);
+    mu_assert_int_eq(123, matches.entries[0]); // Ascending entry order
+    mu_assert_int_eq(5000, matches.entries[matches.count - 1]);
+    history_matches_free(&matches);
+
+    mu_assert(search_history(&hist, "9 ", &matches) == HISTORY_SUCCESS, "short pattern should scan");
+    mu_assert_int_eq(500, matches.count);
+    history_matches_free(&matches);
+
+    mu_assert(find_history_by_result(&hist, ">", 9990, &matches) == HISTORY_SUCCESS, "find should succeed");
+    mu_assert_int_eq(4, matches.count); // 9992 .. 9998
+    mu_assert_int_eq(4996, matches.entries[0]);
+    history_matches_free(&matches);
+
+    add_calculation(&hist, "-1", -1, CALC_SUCCESS); // Lands in the unsorted tail
+    mu_assert(find_history_by_result(&hist, "<=", 0, &matches) == HISTORY_SUCCESS, "find should succeed");
+    mu_assert_int_eq(2, matches.count); // Failed entries have no result
+    mu_assert_int_eq(5001, matches.entries[0]);
+    history_matches_free(&matches);
+    mu_assert(find_history_by_result(&hist, "<>", 0, &matches) != HISTORY_SUCCESS, "unknown operator should fail");
+
+    // Odd results interleave with the sorted run when the next tail is merged
+    for (int i = 0; i < HISTORY_INDEX_MERGE_THRESHOLD + 1; i++)
+        add_calculation(&hist, "odd", i * 2.0 + 1, CALC_SUCCESS);
+    mu_assert(find_history_by_result(&hist, "<", 1e9, &matches) == HISTORY_SUCCESS, "find should succeed");
+    mu_assert_int_eq(5001 + HISTORY_INDEX_MERGE_THRESHOLD + 1, matches.count);
+    int ordered = 1;
+    for (int i = 1; i < matches.count; i++)
+        ordered &= hist.calculations[matches.entries[i - 1]].result <= hist.calculations[matches.entries[i]].result;
+    mu_assert(ordered, "results should come back in value order");
+    history_matches_free(&matches);
+
+    clear_history(&hist);
+    mu_assert(search_history(&hist, "123", &matches) == HISTORY_SUCCESS && matches.count == 0,
+              "clear should empty the index");
+    cleanup_history(&hist);
+}
+
+// The cached formatter matches format_timestamp across day boundaries
+MU_TEST(test_format_timestamp_cached_matches)
+{
+    TimestampCache cache;
+    timestamp_cache_init(&cache);
+    char expected[TIMESTAMP_STRING_SIZE], actual[TIMESTAMP_STRING_SIZE];
+    for (time_t t = 1700000000; t < 1700000000 + 5 * SECONDS_PER_DAY; t += 977)
+    {
+        format_timestamp(t, expected, sizeof(expected));
+        format_timestamp_cached(&cache, t, actual, sizeof(actual));
+        mu_assert(strcmp(expected, actual) == 0, "cached timestamp should match");
+    }
+    format_timestamp(1600000000, expected, sizeof(expected)); // Going back in time
+    format_timestamp_cached(&cache, 1600000000, actual, sizeof(actual));
+    mu_assert_string_eq(expected, actual);
+}
+
+// Time windows use the sorted timestamps; an out-of-order entry forces a scan
+MU_TEST(test_history_time_window)
+{
+    CalculationHistory hist;
+    init_history(&hist);
+    hist.verbose = 0;
+    for (int i = 0; i < 10; i++)
+        add_calculation(&hist, "1 + 1", 2, CALC_SUCCESS);
+    for (int i = 0; i < 10; i++)
+        hist.calculations[i].timestamp = 1000 + 10 * i;
+    mu_assert(hist.timestamps_sorted, "timestamps should be in order");
+
+    FILE *saved = stdout;
+    stdout = fopen("/dev/null", "w");
+    int in_window = display_history_window(&hist, 1015, 1050);
+    int all = display_history_window(&hist, 0, 5000);
+    add_calculation(&hist, "2 + 2", 4, CALC_SUCCESS);
+    hist.calculations[10].timestamp = 1020;
+    hist.timestamps_sorted = 0;
+    int scanned = display_history_window(&hist, 1015, 1050);
+    fclose(stdout);
+    stdout = saved;
+
+    mu_assert_int_eq(4, in_window); // 1020, 1030, 1040, 1050
+    mu_assert_int_eq(10, all);
+    mu_assert_int_eq(5, scanned);
+    cleanup_history(&hist);
+}
+
+// Bulk replay re-evaluates in parallel and flags changed entries
+MU_TEST(test_replay_history_reports_divergence)
+{
+    CalculationHistory hist;
+    init_history(&hist);
+    hist.verbose = 0;
+    char expr[32];
+    for (int i = 0; i < 20000; i++)
+    {
+        snprintf(expr, sizeof(expr), "%d / 4", i);
+        add_calculation(&hist, expr, i / 4.0, CALC_SUCCESS);
+    }
+    hist.calculations[7].result = 1.0;                          // Stored value was wrong
+    hist.calculations[12345].status = CALC_DIVISION_BY_ZERO;    // Status changed
+    add_calculation(&hist, "1 / 0", 0, CALC_DIVISION_BY_ZERO);  // Still an error: no divergence
+
+    ReplayReport report;
+    mu_assert(replay_history(&hist, 0, hist.count, 4, &report) == HISTORY_SUCCESS, "replay should succeed");
+    mu_assert_int_eq(2, report.diverged.count);
+    mu_assert_int_eq(7, report.diverged.entries[0]);
+    mu_assert_int_eq(12345, report.diverged.entries[1]);
+    mu_assert_double_eq(1.75, report.results[7]);
+    mu_assert_int_eq(CALC_DIVISION_BY_ZERO, report.statuses[20000]);
+    free_replay_report(&report);
+
+    mu_assert(replay_history(&hist, 10, 5, 4, &report) == HISTORY_SUCCESS, "sub-range replay should succeed");
+    mu_assert_int_eq(0, report.diverged.count);
+    mu_assert_double_eq(3.5, report.results[4]); // Entry 14
+    free_replay_report(&report);
+    mu_assert(replay_history(&hist, 19990, 100, 1, &report) == HISTORY_INVALID_INDEX, "range past the end should fail");
+    cleanup_history(&hist);
+}
+
 // string_to_double edge cases: empty, whitespace, garbage
 MU_TEST(test_string_to_double_edge_cases)
 {
@@ -177,6 +978,273 @@ MU_TEST(test_string_to_double_edge_cases)
     mu_assert(string_to_double("12abc", &out) == 0, "trailing garbage should fail parse");
 }
 
+// The fast number parser agrees with strtod bit for bit, also on spans and in expressions
+MU_TEST(test_fast_number_parsing)
+{
+    static const char *samples[] = {
+        "0", "-0", "1", "0.1", "0.30000000000000004", "123456789012345678", "9007199254740993",
+        "1e-9", "2.5E+3", "12e25", "1.7976931348623157e308", "4.9e-324", "1e400", "2.2250738585072011e-308",
+        "000123.4500", ".5", "7.", "18446744073709551616", "3.14159265358979323846264338327950288"};
+    int mismatches = 0;
+    char text[64];
+    unsigned long long state = 12345;
+    for (int i = 0; i < 20000; i++)
+    {
+        const char *input = text;
+        if (i < (int)(sizeof(samples) / sizeof(samples[0])))
+            input = samples[i];
+        else
+        {
+            // Random mantissas of 1-20 digits with random exponents
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            snprintf(text, sizeof(text), "%llu.%llue%d", (state >> 20) % 1000000000000ULL,
+                     (state >> 11) % 100000000ULL, (int)(state % 80) - 40);
+        }
+        double fast, expected = strtod(input, NULL);
+        if (parse_double_prefix(input, strlen(input), &fast) != strlen(input) ||
+            memcmp(&fast, &expected, sizeof(double)) != 0)
+            mismatches++;
+    }
+    mu_assert_int_eq(0, mismatches);
+
+    double out;
+    mu_assert_int_eq(4, parse_double_prefix("12.5e", 5, &out)); // Exponent without digits is not consumed
+    mu_assert_double_eq(12.5, out);
+    mu_assert_int_eq(2, parse_double_prefix("4711", 2, &out)); // Stops at the end of the span
+    mu_assert_double_eq(47.0, out);
+    mu_assert(span_to_double("-inf", 4, &out) && isinf(out), "span_to_double should accept what strtod does");
+
+    mu_assert(parse_expression("1e-9 * 1e9 + 2.5E+3", &out, NULL) == CALC_SUCCESS, "exponents should parse");
+    mu_assert_double_eq(2501.0, out);
+    mu_assert(parse_expression("2e", &out, NULL) == CALC_INVALID_INPUT, "dangling exponent should fail");
+    mu_assert(parse_expression("1e400", &out, NULL) == CALC_OVERFLOW, "out-of-range literal should overflow");
+    mu_assert(parse_expression("1e400 - 1e400", &out, NULL) == CALC_OVERFLOW, "no inf or nan from literals");
+}
+
+// The allocator layer accounts for every block and the zones count their calls
+MU_TEST(test_instrumented_allocations)
+{
+    AllocationStats before, after;
+    instrument_allocation_stats(&before);
+    int line = __LINE__ + 1;
+    char *block = safe_malloc(100);
+    block = safe_realloc(block, 300);
+    int *zeroed = safe_calloc(4, sizeof(int));
+    mu_assert(block != NULL && zeroed != NULL && zeroed[3] == 0, "allocations should succeed");
+
+    instrument_allocation_stats(&after);
+    mu_assert_int_eq(3, (int)(after.allocations - before.allocations));
+    mu_assert_int_eq(300 + 4 * sizeof(int), (int)(after.live_bytes - before.live_bytes));
+    mu_assert(after.peak_bytes >= after.live_bytes, "peak should cover live bytes");
+
+    // The realloc took over the block, charged to its own line
+    AllocationSite sites[INSTRUMENT_MAX_SITES];
+    size_t count = instrument_top_sites(sites, INSTRUMENT_MAX_SITES);
+    int found = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (strcmp(sites[i].file, __FILE__) == 0 && sites[i].line == line + 1)
+            found = sites[i].live_bytes >= 300;
+    }
+    mu_assert(found, "realloc call site should hold the live block");
+
+    safe_free(block);
+    safe_free(zeroed);
+    instrument_allocation_stats(&after);
+    mu_assert_int_eq((int)before.live_bytes, (int)after.live_bytes);
+
+    ProfileZoneStats zone_before, zone_after;
+    instrument_zone_stats(PROFILE_PARSE_EXPRESSION, &zone_before);
+    double result;
+    parse_expression("2 * 21", &result, NULL);
+    instrument_zone_stats(PROFILE_PARSE_EXPRESSION, &zone_after);
+    mu_assert_int_eq(1, (int)(zone_after.calls - zone_before.calls));
+}
+
+// Pool blocks are reused, grow in place and move to the heap intact
+MU_TEST(test_fixed_pool_allocator)
+{
+    FixedPool pool;
+    fixed_pool_init(&pool, 64);
+    CalcAllocator allocator = fixed_pool_allocator(&pool);
+
+    int *list = calc_allocate(&allocator, 4 * sizeof(int));
+    for (int i = 0; i < 4; i++)
+        list[i] = i;
+    mu_assert(calc_reallocate(&allocator, list, 4 * sizeof(int), 16 * sizeof(int)) == list,
+              "growing within a block should not move");
+    int *grown = calc_reallocate(&allocator, list, 16 * sizeof(int), 64 * sizeof(int));
+    mu_assert(grown != NULL && grown[3] == 3, "moving to the heap should keep the contents");
+    mu_assert_int_eq(0, (int)pool.blocks_in_use);
+    calc_release(&allocator, grown, 64 * sizeof(int));
+
+    // A released block is the next one handed out
+    void *first = calc_allocate(&allocator, 8);
+    calc_release(&allocator, first, 8);
+    mu_assert(calc_allocate(&allocator, 24) == first, "released blocks should be reused");
+    mu_assert_int_eq(1, (int)pool.slab_count);
+    fixed_pool_free(&pool);
+    mu_assert_int_eq(0, (int)pool.slab_count);
+}
+
+// Loads reserve once, growth follows the factor, clear gives memory back
+MU_TEST(test_history_reserve_and_shrink)
+{
+    CalculationHistory hist;
+    init_history(&hist);
+    hist.verbose = HISTORY_VERBOSE_QUIET;
+    hist.growth_factor = 1.5;
+    for (int i = 0; i <= INITIAL_HISTORY_CAPACITY; i++)
+        add_calculation(&hist, "1 + 1", 2, CALC_SUCCESS);
+    mu_assert_int_eq(INITIAL_HISTORY_CAPACITY * 3 / 2, hist.capacity);
+
+    mu_assert(reserve_history(&hist, 10000) == HISTORY_SUCCESS, "reserve should succeed");
+    mu_assert_int_eq(10000, hist.capacity);
+    mu_assert(reserve_history(&hist, 10) == HISTORY_SUCCESS && hist.capacity == 10000,
+              "reserve should never shrink");
+    for (int i = hist.count; i < 10000; i++)
+        add_calculation(&hist, "2 * 3", 6, CALC_SUCCESS);
+    mu_assert_int_eq(10000, hist.capacity);
+    save_history_to_file(&hist, "test_reserve.dat");
+
+    CalculationHistory loaded;
+    init_history(&loaded);
+    loaded.verbose = HISTORY_VERBOSE_QUIET;
+    load_history_from_file(&loaded, "test_reserve.dat");
+    mu_assert_int_eq(10000, loaded.count);
+    mu_assert_int_eq(10000, loaded.capacity); // Sized from the block headers, no growth
+    cleanup_history(&loaded);
+    remove("test_reserve.dat");
+
+    clear_history(&hist);
+    mu_assert_int_eq(INITIAL_HISTORY_CAPACITY, hist.capacity);
+    mu_assert_int_eq(0, (int)hist.postings_pool.slab_count);
+    add_calculation(&hist, "7 - 1", 6, CALC_SUCCESS);
+    mu_assert_int_eq(1, hist.count);
+    cleanup_history(&hist);
+}
+
+// With a memory limit old entries live only in the journal file and are
+// paged back by index
+MU_TEST(test_history_memory_limit_pages_evicted_entries)
+{
+    remove("test_bounded.dat");
+    remove("test_bounded_copy.dat");
+    CalculationHistory hist;
+    init_history(&hist);
+    hist.verbose = HISTORY_VERBOSE_QUIET;
+    char expr[32];
+    for (int i = 0; i < 50; i++) // Not in the file yet: setting the limit rewrites it
+    {
+        snprintf(expr, sizeof(expr), "%d + 1", i);
+        add_calculation(&hist, expr, i + 1, CALC_SUCCESS);
+    }
+    mu_assert(set_history_memory_limit(&hist, 100) == HISTORY_FILE_ERROR,
+              "a limit needs a journal");
+    mu_assert(attach_history_journal(&hist, "test_bounded.dat", 7) == HISTORY_SUCCESS, "attach should succeed");
+    mu_assert(set_history_memory_limit(&hist, 100) == HISTORY_SUCCESS, "limit should be accepted");
+
+    const int total = 10050;
+    int most_resident = 0;
+    for (int i = 50; i < total; i++)
+    {
+        snprintf(expr, sizeof(expr), "%d + 1", i);
+        add_calculation(&hist, expr, i + 1, CALC_SUCCESS);
+        if (hist.count - hist.first_resident > most_resident)
+            most_resident = hist.count - hist.first_resident;
+    }
+    mu_assert_int_eq(100, most_resident);
+    mu_assert_int_eq(total, hist.count);
+    mu_assert(hist.capacity <= 101, "the entry array should stay within the limit");
+
+    // Random and sequential access across evicted and resident entries
+    int probes[] = {0, 49, 50, 4097, 9000, total - 1, 3};
+    for (size_t k = 0; k < sizeof(probes) / sizeof(probes[0]); k++)
+    {
+        const Calculation *calc = history_entry(&hist, probes[k]);
+        snprintf(expr, sizeof(expr), "%d + 1", probes[k]);
+        mu_assert(calc != NULL, "every entry should be reachable");
+        mu_assert_string_eq(expr, calc->expression_str);
+        mu_assert_double_eq(probes[k] + 1, calc->result);
+    }
+    int matching = 0;
+    for (int i = 0; i < total; i++)
+    {
+        const Calculation *calc = history_entry(&hist, i);
+        snprintf(expr, sizeof(expr), "%d + 1", i);
+        matching += calc != NULL && strcmp(calc->expression_str, expr) == 0;
+    }
+    mu_assert_int_eq(total, matching);
+    mu_assert(history_entry(&hist, total) == NULL, "out of range should be NULL");
+
+    double result;
+    CalcResult status;
+    mu_assert(replay_calculation(&hist, 3, &result, &status) == HISTORY_SUCCESS, "replay should page in");
+    mu_assert_double_eq(4.0, result);
+    ReplayReport report;
+    mu_assert(replay_history(&hist, 0, total, 2, &report) == HISTORY_SUCCESS, "replay all should succeed");
+    mu_assert_int_eq(0, report.diverged.count);
+    mu_assert_double_eq(5001.0, report.results[5000]);
+    free_replay_report(&report);
+
+    // Searches cover the resident entries, reported by absolute index
+    HistoryMatches matches;
+    history_matches_init(&matches);
+    search_history(&hist, "10049 +", &matches);
+    mu_assert_int_eq(1, matches.count);
+    mu_assert_int_eq(total - 1, matches.entries[0]);
+    history_matches_free(&matches);
+
+    // Saving elsewhere writes every entry; saving to the journal only flushes
+    mu_assert(save_history_to_file(&hist, "test_bounded_copy.dat") == HISTORY_SUCCESS, "save should succeed");
+    mu_assert(save_history_to_file(&hist, "test_bounded.dat") == HISTORY_SUCCESS, "save should succeed");
+    const char *files[] = {"test_bounded_copy.dat", "test_bounded.dat"};
+    for (int f = 0; f < 2; f++)
+    {
+        CalculationHistory loaded;
+        init_history(&loaded);
+        loaded.verbose = HISTORY_VERBOSE_QUIET;
+        mu_assert(load_history_from_file(&loaded, files[f]) == HISTORY_SUCCESS, "load should succeed");
+        mu_assert_int_eq(total, loaded.count);
+        mu_assert_string_eq("0 + 1", loaded.calculations[0].expression_str);
+        mu_assert_string_eq("10049 + 1", loaded.calculations[total - 1].expression_str);
+        cleanup_history(&loaded);
+    }
+
+    // A rebuild that ran out of memory: queries scan until the next eviction
+    history_index_free(&hist.index);
+    hist.index_complete = 0;
+    history_matches_init(&matches);
+    search_history(&hist, "10049 +", &matches);
+    mu_assert_int_eq(1, matches.count);
+    mu_assert_int_eq(total - 1, matches.entries[0]);
+    matches.count = 0;
+    mu_assert(find_history_by_result(&hist, ">", total - 2, &matches) == HISTORY_SUCCESS, "find should scan");
+    mu_assert_int_eq(2, matches.count);
+    mu_assert_int_eq(total - 2, matches.entries[0]);
+    mu_assert_int_eq(total - 1, matches.entries[1]);
+    for (int i = total; i < total + 100; i++)
+    {
+        snprintf(expr, sizeof(expr), "%d + 1", i);
+        add_calculation(&hist, expr, i + 1, CALC_SUCCESS);
+    }
+    mu_assert(hist.index_complete, "eviction should rebuild the index");
+    matches.count = 0;
+    search_history(&hist, "10149 +", &matches);
+    mu_assert_int_eq(1, matches.count);
+    mu_assert_int_eq(total + 99, matches.entries[0]);
+    history_matches_free(&matches);
+
+    clear_history(&hist);
+    mu_assert_int_eq(0, hist.count);
+    mu_assert_int_eq(0, hist.first_resident);
+    add_calculation(&hist, "7 - 1", 6, CALC_SUCCESS);
+    mu_assert_string_eq("7 - 1", history_entry(&hist, 0)->expression_str);
+    cleanup_history(&hist);
+    remove("test_bounded.dat");
+    remove("test_bounded_copy.dat");
+}
+
 // Run all tests
 int main(int argc, char **argv)
 {
@@ -184,11 +1252,37 @@ int main(int argc, char **argv)
     MU_RUN_TEST(test_add_calculation_grows_array_correctly);
     MU_RUN_TEST(test_arithmetic_operations);
     MU_RUN_TEST(test_power_function);
+    MU_RUN_TEST(test_batch_arithmetic_kernels);
     MU_RUN_TEST(test_parse_expression_valid_and_invalid);
+    MU_RUN_TEST(test_parse_expression_precedence);
+    MU_RUN_TEST(test_compile_and_evaluate_expression);
+    MU_RUN_TEST(test_variables_and_batch_evaluation);
     MU_RUN_TEST(test_validation_helpers);
     MU_RUN_TEST(test_history_clear_and_replay);
     MU_RUN_TEST(test_file_persistence_roundtrip);
+    MU_RUN_TEST(test_load_history_scans_csv_in_place);
+    MU_RUN_TEST(test_history_journal_appends_and_compacts);
+    MU_RUN_TEST(test_history_csv_export_import);
+    MU_RUN_TEST(test_history_binary_detects_corruption);
+    MU_RUN_TEST(test_string_arena_chunks);
     MU_RUN_TEST(test_string_to_double_edge_cases);
+    MU_RUN_TEST(test_fast_number_parsing);
+    MU_RUN_TEST(test_instrumented_allocations);
+    MU_RUN_TEST(test_fixed_pool_allocator);
+    MU_RUN_TEST(test_history_reserve_and_shrink);
+    MU_RUN_TEST(test_history_memory_limit_pages_evicted_entries);
+    MU_RUN_TEST(test_format_double_round_trips);
+    MU_RUN_TEST(test_thread_pool_runs_every_task_once);
+    MU_RUN_TEST(test_run_batch_parallel_matches_serial);
+    MU_RUN_TEST(test_concurrent_history_appends);
+    MU_RUN_TEST(test_server_pipelines_requests);
+    MU_RUN_TEST(test_client_pipes_stdin);
+    MU_RUN_TEST(test_expression_cache_hits_and_evicts);
+    MU_RUN_TEST(test_history_search_and_find);
+    MU_RUN_TEST(test_format_timestamp_cached_matches);
+    MU_RUN_TEST(test_history_time_window);
+    MU_RUN_TEST(test_replay_history_reports_divergence);
+    MU_RUN_TEST(test_run_batch_streams_results);
     
     MU_REPORT();
     return MU_EXIT_CODE;
@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "thread_pool.h"
+#include "utils.h"
+
+// Remaining tasks of one worker. The owner takes tasks from the end, thieves
+// split off the front half.
+typedef struct
+{
+    pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+} TaskDeque;
+
+typedef struct
+{
+    ThreadPool *pool;
+    int id;
+} WorkerArgs;
+
+struct ThreadPool
+{
+    int size;
+    pthread_t threads[THREAD_POOL_MAX_THREADS];
+    WorkerArgs args[THREAD_POOL_MAX_THREADS];
+    TaskDeque deques[THREAD_POOL_MAX_THREADS];
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready; // A new run started or the pool is shutting down
+    pthread_cond_t work_done;  // The last worker finished a run
+    unsigned long generation;  // Incremented per run
+    int active;                // Pool threads still working on the current run
+    int shutting_down;
+
+    TaskFunction function;
+    void *context;
+};
+
+static int pop_task(TaskDeque *deque, size_t *task)
+{
+    int found = 0;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->begin < deque->end)
+    {
+        *task = --deque->end;
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// Move half of another worker's remaining range into our (empty) deque
+static int steal_tasks(ThreadPool *pool, int thief)
+{
+    for (int offset = 1; offset < pool->size; offset++)
+    {
+        TaskDeque *victim = &pool->deques[(thief + offset) % pool->size];
+        pthread_mutex_lock(&victim->lock);
+        size_t remaining = victim->end - victim->begin;
+        if (remaining == 0)
+        {
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        size_t taken = (remaining + 1) / 2;
+        size_t begin = victim->begin;
+        victim->begin += taken;
+        pthread_mutex_unlock(&victim->lock);
+
+        TaskDeque *own = &pool->deques[thief];
+        pthread_mutex_lock(&own->lock);
+        own->begin = begin;
+        own->end = begin + taken;
+        pthread_mutex_unlock(&own->lock);
+        return 1;
+    }
+    return 0;
+}
+
+// Work until every deque is empty. Tasks never create tasks, so once a full
+// sweep finds nothing to steal this worker is done.
+static void work(ThreadPool *pool, int id)
+{
+    size_t task;
+    do
+    {
+        while (pop_task(&pool->deques[id], &task))
+            pool->function(pool->context, task, id);
+    } while (steal_tasks(pool, id));
+}
+
+static void *worker_main(void *arg)
+{
+    WorkerArgs *args = arg;
+    ThreadPool *pool = args->pool;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1)
+    {
+        while (!pool->shutting_down && pool->generation == seen)
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        if (pool->shutting_down)
+            break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        work(pool, args->id);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0)
+            pthread_cond_signal(&pool->work_done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+ThreadPool *thread_pool_create(int threads)
+{
+    if (threads < 1)
+        threads = 1;
+    if (threads > THREAD_POOL_MAX_THREADS)
+        threads = THREAD_POOL_MAX_THREADS;
+
+    ThreadPool *pool = safe_calloc(1, sizeof(ThreadPool));
+    if (pool == NULL)
+        return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    for (int i = 0; i < threads; i++)
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+
+    // Worker 0 is whoever calls thread_pool_run
+    pool->size = 1;
+    for (int i = 1; i < threads; i++)
+    {
+        pool->args[i].pool = pool;
+        pool->args[i].id = i;
+        if (pthread_create(&pool->threads[i], NULL, worker_main, &pool->args[i]) != 0)
+            break; // Run with the workers we have
+        pool->size = i + 1;
+    }
+    for (int i = pool->size; i < threads; i++)
+        pthread_mutex_destroy(&pool->deques[i].lock);
+    return pool;
+}
+
+int thread_pool_size(const ThreadPool *pool)
+{
+    return pool != NULL ? pool->size : 1;
+}
+
+void thread_pool_run(ThreadPool *pool, size_t task_count, TaskFunction function, void *context)
+{
+    if (pool == NULL || task_count == 0)
+        return;
+
+    // Deal out contiguous ranges so neighbouring tasks share a worker
+    for (int i = 0; i < pool->size; i++)
+    {
+        pool->deques[i].begin = task_count * i / pool->size;
+        pool->deques[i].end = task_count * (i + 1) / pool->size;
+    }
+    pool->function = function;
+    pool->context = context;
+
+    if (pool->size > 1)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pool->active = pool->size - 1;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->work_ready);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    work(pool, 0);
+
+    if (pool->size > 1)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->active > 0)
+            pthread_cond_wait(&pool->work_done, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+void thread_pool_destroy(ThreadPool *pool)
+{
+    if (pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutting_down = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 1; i < pool->size; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    for (int i = 0; i < pool->size; i++)
+        pthread_mutex_destroy(&pool->deques[i].lock);
+    pthread_cond_destroy(&pool->work_done);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_mutex_destroy(&pool->lock);
+    safe_free(pool);
+}
+
+int thread_pool_default_size(void)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1)
+        return 1;
+    return cores > THREAD_POOL_MAX_THREADS ? THREAD_POOL_MAX_THREADS : (int)cores;
+}
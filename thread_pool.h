@@ -0,0 +1,29 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+#define THREAD_POOL_MAX_THREADS 256
+
+// Runs one task; worker is 0 for the calling thread and 1..threads-1 for
+// pool threads, so callers can keep per-worker state in an array
+typedef void (*TaskFunction)(void *context, size_t task, int worker);
+
+typedef struct ThreadPool ThreadPool;
+
+// Start threads - 1 workers; the thread calling thread_pool_run is the last
+// one. Returns NULL on failure.
+ThreadPool *thread_pool_create(int threads);
+int thread_pool_size(const ThreadPool *pool);
+
+// Run tasks [0, task_count) and return when all have finished. Tasks are
+// dealt out in contiguous ranges, one per worker; a worker that runs out
+// steals half of the remaining range of another.
+void thread_pool_run(ThreadPool *pool, size_t task_count, TaskFunction function, void *context);
+
+void thread_pool_destroy(ThreadPool *pool);
+
+// Number of online cores, at least 1
+int thread_pool_default_size(void);
+
+#endif // THREAD_POOL_H
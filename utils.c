@@ -1,46 +1,106 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <float.h>
+#include <math.h>
 #include "utils.h"
+#include "instrument.h"
+
+// Every block carries its size and call site so safe_free can account for it
+typedef struct
+{
+    _Alignas(max_align_t) size_t size;
+    int site;
+} AllocationHeader;
 
 // Safe string duplication
-char *safe_string_copy(const char *source)
+char *safe_string_copy_at(const char *source, const char *file, int line)
 {
     if (source == NULL)
         return NULL;
 
     size_t len = strlen(source) + 1;
-    char *copy = malloc(len);
+    char *copy = safe_malloc_at(len, file, line);
     if (copy == NULL)
     {
         print_error("Memory allocation failed for string copy");
         return NULL;
     }
-    strcpy(copy, source);
+    memcpy(copy, source, len);
     return copy;
 }
 
 // Safe memory allocation with error handling
-void *safe_malloc(size_t size)
+void *safe_malloc_at(size_t size, const char *file, int line)
 {
-    void *ptr = malloc(size);
-    if (ptr == NULL && size > 0)
+    AllocationHeader *header = size <= SIZE_MAX - sizeof(AllocationHeader)
+                                   ? malloc(sizeof(AllocationHeader) + size)
+                                   : NULL;
+    if (header == NULL)
+    {
+        print_error("Memory allocation failed ");
+        return NULL;
+    }
+    header->size = size;
+    header->site = instrument_site(file, line);
+    instrument_allocated(header->site, size);
+    return header + 1;
+}
+
+void *safe_calloc_at(size_t count, size_t size, const char *file, int line)
+{
+    if (size != 0 && count > (SIZE_MAX - sizeof(AllocationHeader)) / size)
+    {
+        print_error("Memory allocation failed ");
+        return NULL;
+    }
+    AllocationHeader *header = calloc(1, sizeof(AllocationHeader) + count * size);
+    if (header == NULL)
     {
         print_error("Memory allocation failed ");
+        return NULL;
     }
-    return ptr;
+    header->size = count * size;
+    header->site = instrument_site(file, line);
+    instrument_allocated(header->site, header->size);
+    return header + 1;
 }
 
-// Safe reallocation
-void *safe_realloc(void *ptr, size_t new_size)
+// Safe reallocation. Counted as a free of the old block and an allocation
+// of the new one, charged to this call site.
+void *safe_realloc_at(void *ptr, size_t new_size, const char *file, int line)
 {
-    void *new_ptr = realloc(ptr, new_size);
-    if (new_ptr == NULL && new_size > 0)
+    if (ptr == NULL)
+        return safe_malloc_at(new_size, file, line);
+
+    AllocationHeader *header = (AllocationHeader *)ptr - 1;
+    size_t old_size = header->size;
+    int old_site = header->site;
+    AllocationHeader *grown = new_size <= SIZE_MAX - sizeof(AllocationHeader)
+                                  ? realloc(header, sizeof(AllocationHeader) + new_size)
+                                  : NULL;
+    if (grown == NULL)
     {
         print_error("Memory reallocation failed ");
         // Original pointer is still valid
+        return NULL;
     }
-    return new_ptr;
+    instrument_released(old_site, old_size);
+    grown->size = new_size;
+    grown->site = instrument_site(file, line);
+    instrument_allocated(grown->site, new_size);
+    return grown + 1;
+}
+
+void safe_free(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    AllocationHeader *header = (AllocationHeader *)ptr - 1;
+    instrument_released(header->site, header->size);
+    free(header);
 }
 
 // Remove spaces and tabs from string
@@ -60,18 +120,172 @@ void remove_spaces(char *str)
     str[j] = '\0';
 }
 
+// Exact powers of ten: every one up to 1e22 is representable in a double
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+#define MAX_EXACT_POWER_OF_TEN 22
+#define MAX_EXACT_MANTISSA (1ULL << 53)
+#define MAX_MANTISSA_DIGITS 19 // Decimal digits that always fit in 64 bits
+#define NUMBER_COPY_SIZE 64
+
+// strtod on a span that may not be NUL-terminated
+static double strtod_span(const char *text, size_t length)
+{
+    char local[NUMBER_COPY_SIZE];
+    char *copy = length < sizeof(local) ? local : safe_malloc(length + 1);
+    if (copy == NULL)
+        return NAN;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    double value = strtod(copy, NULL);
+    if (copy != local)
+        safe_free(copy);
+    return value;
+}
+
+// Scan [+-]digits[.digits][(e|E)[+-]digits] and convert it. A mantissa of at
+// most 2^53 scaled by 10^-22..10^22 is exact in both operands, so one IEEE
+// multiply or divide gives the correctly rounded result (Clinger's fast
+// path); a larger exponent is split when the mantissa has room to absorb
+// part of it. Anything else goes to strtod.
+size_t parse_double_prefix(const char *text, size_t length, double *result)
+{
+    size_t pos = 0;
+    int negative = 0;
+    if (pos < length && (text[pos] == '+' || text[pos] == '-'))
+        negative = text[pos++] == '-';
+
+    uint64_t mantissa = 0;
+    int digits = 0;       // Significant digits in mantissa
+    int dropped = 0;      // Significant digits that did not fit
+    long exponent = 0;    // Decimal exponent of mantissa
+    int seen_digit = 0;
+    for (int fraction = 0; pos < length; pos++)
+    {
+        char c = text[pos];
+        if (c >= '0' && c <= '9')
+        {
+            seen_digit = 1;
+            if (digits < MAX_MANTISSA_DIGITS)
+            {
+                mantissa = mantissa * 10 + (uint64_t)(c - '0');
+                digits += mantissa != 0; // Leading zeros are not significant
+                exponent -= fraction;
+            }
+            else
+            {
+                dropped = 1;
+                exponent += !fraction;
+            }
+        }
+        else if (c == '.' && !fraction)
+            fraction = 1;
+        else
+            break;
+    }
+    if (!seen_digit)
+        return 0;
+
+    // Exponent only if digits follow, so "2e" scans as 2 followed by "e"
+    if (pos < length && (text[pos] == 'e' || text[pos] == 'E'))
+    {
+        size_t exp_pos = pos + 1;
+        int exp_negative = 0;
+        if (exp_pos < length && (text[exp_pos] == '+' || text[exp_pos] == '-'))
+            exp_negative = text[exp_pos++] == '-';
+        if (exp_pos < length && text[exp_pos] >= '0' && text[exp_pos] <= '9')
+        {
+            long value = 0;
+            for (; exp_pos < length && text[exp_pos] >= '0' && text[exp_pos] <= '9'; exp_pos++)
+            {
+                if (value < 100000) // Saturate far beyond any double's range
+                    value = value * 10 + (text[exp_pos] - '0');
+            }
+            exponent += exp_negative ? -value : value;
+            pos = exp_pos;
+        }
+    }
+
+    double value;
+#if FLT_EVAL_METHOD == 0
+    if (mantissa == 0 && !dropped)
+        value = 0.0;
+    else if (!dropped && mantissa <= MAX_EXACT_MANTISSA && exponent >= -MAX_EXACT_POWER_OF_TEN &&
+             exponent <= MAX_EXACT_POWER_OF_TEN)
+    {
+        value = (double)mantissa;
+        value = exponent < 0 ? value / exact_powers_of_ten[-exponent] : value * exact_powers_of_ten[exponent];
+    }
+    else if (!dropped && exponent > MAX_EXACT_POWER_OF_TEN &&
+             exponent <= MAX_EXACT_POWER_OF_TEN + 15 &&
+             mantissa <= MAX_EXACT_MANTISSA / (uint64_t)exact_powers_of_ten[exponent - MAX_EXACT_POWER_OF_TEN])
+    {
+        // e.g. 12e25 == 12000e22, both factors still exact
+        value = (double)(mantissa * (uint64_t)exact_powers_of_ten[exponent - MAX_EXACT_POWER_OF_TEN]) *
+                exact_powers_of_ten[MAX_EXACT_POWER_OF_TEN];
+    }
+    else
+#endif
+    {
+        *result = strtod_span(text, pos); // The scanned text is valid strtod syntax
+        return pos;
+    }
+    *result = negative ? -value : value;
+    return pos;
+}
+
+// Convert a whole span; anything the fast scanner does not cover
+// (whitespace, inf, nan, hex) gets strtod's reading of it
+int span_to_double(const char *text, size_t length, double *result)
+{
+    if (text == NULL || result == NULL)
+        return 0;
+
+    if (length > 0 && parse_double_prefix(text, length, result) == length)
+        return 1;
+
+    char local[NUMBER_COPY_SIZE];
+    char *copy = length < sizeof(local) ? local : safe_malloc(length + 1);
+    if (copy == NULL)
+        return 0;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    char *endptr;
+    *result = strtod(copy, &endptr);
+    int ok = *endptr == '\0' && endptr != copy;
+    if (copy != local)
+        safe_free(copy);
+    return ok;
+}
+
 // Convert string to double with error checking
 int string_to_double(const char *str, double *result)
 {
     if (str == NULL || result == NULL)
         return 0;
+    return span_to_double(str, strlen(str), result);
+}
 
-    char *endptr;
-    *result = strtod(str, &endptr);
+// Shortest round-trip formatting. Any decimal of up to DBL_DIG (15)
+// significant digits survives a double round trip, so "%.15g" already
+// gives the shortest form for most values; only the rest need 16 or 17.
+int format_double(double value, char *buffer, size_t buffer_size)
+{
+    if (buffer == NULL || buffer_size == 0)
+        return 0;
 
-    // Check if conversion was successful
-    return (*endptr == '\0' && endptr != str);
+    int length = 0;
+    for (int precision = DBL_DIG; precision <= DBL_DECIMAL_DIG; precision++)
+    {
+        length = snprintf(buffer, buffer_size, "%.*g", precision, value);
+        if (!isfinite(value) || strtod(buffer, NULL) == value)
+            break;
+    }
+    return length;
 }
+
 // Error and warning printing functions
 void print_error(const char *message)
 {
@@ -97,4 +311,102 @@ void clear_input_buffer(void)
     {
         // Clear buffer
     }
-}
\ No newline at end of file
+}
+
+// Buffered output
+int output_buffer_init(OutputBuffer *buf, FILE *stream, size_t capacity)
+{
+    if (buf == NULL || stream == NULL || capacity == 0)
+        return 0;
+
+    buf->data = safe_malloc(capacity);
+    if (buf->data == NULL)
+        return 0;
+    buf->stream = stream;
+    buf->length = 0;
+    buf->capacity = capacity;
+    return 1;
+}
+
+void output_buffer_write(OutputBuffer *buf, const char *text, size_t length)
+{
+    if (buf->length + length > buf->capacity)
+    {
+        output_buffer_flush(buf);
+        if (length > buf->capacity)
+        {
+            // Too large to buffer, write it straight through
+            fwrite(text, 1, length, buf->stream);
+            return;
+        }
+    }
+    memcpy(buf->data + buf->length, text, length);
+    buf->length += length;
+}
+
+void output_buffer_printf(OutputBuffer *buf, const char *format, ...)
+{
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if (written < 0)
+        return;
+    if ((size_t)written >= sizeof(line))
+        written = sizeof(line) - 1; // Truncated
+    output_buffer_write(buf, line, (size_t)written);
+}
+
+void output_buffer_flush(OutputBuffer *buf)
+{
+    if (buf->length > 0)
+    {
+        fwrite(buf->data, 1, buf->length, buf->stream);
+        buf->length = 0;
+    }
+    fflush(buf->stream);
+}
+
+void output_buffer_free(OutputBuffer *buf)
+{
+    if (buf == NULL)
+        return;
+    safe_free(buf->data);
+    buf->data = NULL;
+    buf->length = 0;
+    buf->capacity = 0;
+}
+
+void byte_buffer_init(ByteBuffer *buf)
+{
+    buf->data = NULL;
+    buf->length = 0;
+    buf->capacity = 0;
+}
+
+// Make room for extra more bytes; returns 0 if that needs memory we cannot get
+int byte_buffer_reserve(ByteBuffer *buf, size_t extra)
+{
+    if (buf->length + extra <= buf->capacity)
+        return 1;
+
+    size_t capacity = buf->capacity > 0 ? buf->capacity : 4096;
+    while (capacity < buf->length + extra)
+        capacity *= 2;
+    unsigned char *grown = safe_realloc(buf->data, capacity);
+    if (grown == NULL)
+        return 0;
+    buf->data = grown;
+    buf->capacity = capacity;
+    return 1;
+}
+
+void byte_buffer_free(ByteBuffer *buf)
+{
+    if (buf == NULL)
+        return;
+    safe_free(buf->data);
+    byte_buffer_init(buf);
+}
@@ -1,20 +1,70 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stddef.h>
+#include <stdio.h>
+
 // String utilities
-char *safe_string_copy(const char *source);
+char *safe_string_copy_at(const char *source, const char *file, int line);
+#define safe_string_copy(source) safe_string_copy_at((source), __FILE__, __LINE__)
 void remove_spaces(char *str);
 void trim_whitespace(char *str);
 int string_to_double(const char *str, double *result);
 
+// Number parsing on spans that need not be NUL-terminated.
+// parse_double_prefix reads the longest prefix of the form
+// [+-]digits[.digits][(e|E)[+-]digits] and returns its length (0 if there is
+// none); the result is correctly rounded. span_to_double converts a whole
+// span, accepting the same spellings as strtod; returns 1 on success.
+size_t parse_double_prefix(const char *text, size_t length, double *result);
+int span_to_double(const char *text, size_t length, double *result);
+
+// Number formatting: shortest text that parses back to the same double
+#define DOUBLE_STRING_SIZE 32
+int format_double(double value, char *buffer, size_t buffer_size);
+
 // Input utilities
 void clear_input_buffer(void);
 int get_user_input(char *buffer, size_t buffer_size);
 int get_integer_input(const char *prompt, int *result);
 
-// Memory utilities
-void *safe_malloc(size_t size);
-void *safe_realloc(void *ptr, size_t new_size);
+// Memory utilities. All project allocations go through these so that
+// instrument.c can count them per call site; memory they return must be
+// released with safe_free, never with free.
+void *safe_malloc_at(size_t size, const char *file, int line);
+void *safe_calloc_at(size_t count, size_t size, const char *file, int line);
+void *safe_realloc_at(void *ptr, size_t new_size, const char *file, int line);
+void safe_free(void *ptr);
+#define safe_malloc(size) safe_malloc_at((size), __FILE__, __LINE__)
+#define safe_calloc(count, size) safe_calloc_at((count), (size), __FILE__, __LINE__)
+#define safe_realloc(ptr, new_size) safe_realloc_at((ptr), (new_size), __FILE__, __LINE__)
+
+// Buffered output: collects text and hands it to the stream in large writes
+typedef struct
+{
+    FILE *stream;
+    char *data;
+    size_t length;
+    size_t capacity;
+} OutputBuffer;
+
+// Growable byte buffer
+typedef struct
+{
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+} ByteBuffer;
+
+void byte_buffer_init(ByteBuffer *buf);
+int byte_buffer_reserve(ByteBuffer *buf, size_t extra);
+void byte_buffer_free(ByteBuffer *buf);
+
+int output_buffer_init(OutputBuffer *buf, FILE *stream, size_t capacity);
+void output_buffer_write(OutputBuffer *buf, const char *text, size_t length);
+void output_buffer_printf(OutputBuffer *buf, const char *format, ...);
+void output_buffer_flush(OutputBuffer *buf);
+void output_buffer_free(OutputBuffer *buf);
 
 // Error handling utilities
 void print_error(const char *message);